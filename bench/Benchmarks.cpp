@@ -0,0 +1,444 @@
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "PluginEditor.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+namespace
+{
+std::atomic<size_t> liveHeapBytes { 0 };
+std::atomic<size_t> peakHeapBytes { 0 };
+std::atomic<size_t> liveHeapAllocations { 0 };
+constexpr size_t allocationHeaderSize = alignof (std::max_align_t);
+} // namespace
+
+// Every allocation carries a small header holding its size, so the benchmarks can report
+// the peak heap growth of an operation.
+void* operator new (size_t size)
+{
+    auto* block = static_cast<char*> (std::malloc (size + allocationHeaderSize));
+    if (block == nullptr)
+        throw std::bad_alloc();
+
+    *reinterpret_cast<size_t*> (block) = size;
+    ++liveHeapAllocations;
+    const auto live = liveHeapBytes.fetch_add (size) + size;
+    auto peak = peakHeapBytes.load();
+    while (live > peak && ! peakHeapBytes.compare_exchange_weak (peak, live)) {}
+    return block + allocationHeaderSize;
+}
+
+void operator delete (void* pointer) noexcept
+{
+    if (pointer == nullptr)
+        return;
+
+    auto* block = static_cast<char*> (pointer) - allocationHeaderSize;
+    liveHeapBytes.fetch_sub (*reinterpret_cast<size_t*> (block));
+    --liveHeapAllocations;
+    std::free (block);
+}
+
+void* operator new[] (size_t size) { return operator new (size); }
+void operator delete[] (void* pointer) noexcept { operator delete (pointer); }
+void operator delete (void* pointer, size_t) noexcept { operator delete (pointer); }
+void operator delete[] (void* pointer, size_t) noexcept { operator delete (pointer); }
+
+namespace
+{
+volatile int sink = 0;
+juce::Array<juce::var> results;
+bool formatChanged = false;
+
+// A task as the plugin stored it before the snapshot tree: one flat array of these.
+struct LegacyTask
+{
+    juce::String text;
+    bool done = false;
+};
+
+/** Starts a record in the report for one benchmark run at one list size; the benchmark
+    fills in what it measured.
+*/
+juce::DynamicObject& addResult (const char* benchmark, int numTasks)
+{
+    std::cerr << benchmark << ", " << numTasks << " tasks" << std::endl;
+
+    auto* result = new juce::DynamicObject();
+    results.add (juce::var (result));
+    result->setProperty ("benchmark", benchmark);
+    result->setProperty ("tasks", numTasks);
+    return *result;
+}
+
+template <typename Function>
+size_t peakHeapGrowth (Function&& function)
+{
+    const auto baseline = liveHeapBytes.load();
+    peakHeapBytes = baseline;
+    function();
+    return peakHeapBytes.load() - baseline;
+}
+
+template <typename Function>
+double millisecondsPerIteration (int iterations, Function&& function)
+{
+    const auto start = juce::Time::getHighResolutionTicks();
+    for (int i = 0; i < iterations; ++i)
+        function();
+    const auto elapsed = juce::Time::getHighResolutionTicks() - start;
+    return juce::Time::highResolutionTicksToSeconds (elapsed) * 1000.0 / (double) iterations;
+}
+
+// Every tenth task is done. Archiving is turned off so that all of them stay in the list.
+void fillProcessor (TodoListNativeAudioProcessor& processor, int numTasks)
+{
+    processor.setArchiveThreshold (0);
+    processor.applyBatch ([numTasks] (TodoListNativeAudioProcessor::Batch& batch)
+    {
+        for (int i = 0; i < numTasks; ++i)
+            batch.addTask ("benchmark task number " + juce::String (i));
+        for (int i = 0; i < numTasks; i += 10)
+            batch.setTaskDone (i, true);
+    });
+}
+
+// The single-task edits the editor makes, each one published as a snapshot of its own. The
+// tasks appended first are removed again from the middle, leaving the list as it started.
+void benchmarkEdits (int numTasks)
+{
+    TodoListNativeAudioProcessor processor;
+    fillProcessor (processor, numTasks);
+
+    auto& result = addResult ("edits", numTasks);
+    const auto iterations = juce::jmax (20, 100000 / numTasks);
+    bool toggle = false;
+
+    result.setProperty ("addTaskMs", millisecondsPerIteration (iterations, [&] { processor.addTask ("appended benchmark task"); }));
+    result.setProperty ("moveTaskMs", millisecondsPerIteration (iterations, [&] { processor.moveTask (processor.getNumTasks() - 1, 0); }));
+    result.setProperty ("setTaskDoneMs", millisecondsPerIteration (iterations, [&] { processor.setTaskDone (processor.getNumTasks() / 2, toggle = ! toggle); }));
+    result.setProperty ("removeTaskMs", millisecondsPerIteration (iterations, [&] { processor.removeTask (processor.getNumTasks() / 2); }));
+}
+
+void benchmarkPaint (int numTasks)
+{
+    TodoListNativeAudioProcessor processor;
+    fillProcessor (processor, numTasks);
+
+    auto& result = addResult ("paint", numTasks);
+    TaskListComponent list (processor);
+    list.setSize (422, list.getPreferredHeight());
+    juce::Image frame (juce::Image::ARGB, 422, 300, true);
+
+    const auto iterations = juce::jmax (5, 200000 / numTasks);
+
+    // The reads as paint made them before snapshots: the flat array behind a lock, taken
+    // for the size and again to copy out each row.
+    juce::CriticalSection legacyLock;
+    juce::Array<LegacyTask> legacyTasks;
+    for (int i = 0; i < numTasks; ++i)
+        legacyTasks.add ({ "benchmark task number " + juce::String (i), i % 10 == 0 });
+
+    const auto lockedRowReads = millisecondsPerIteration (iterations, [&]
+    {
+        const auto num = [&] { const juce::ScopedLock sl (legacyLock); return legacyTasks.size(); }();
+        int done = 0;
+        for (int i = 0; i < num; ++i)
+        {
+            const auto task = [&] { const juce::ScopedLock sl (legacyLock); return legacyTasks[i]; }();
+            if (task.done)
+                ++done;
+        }
+        sink = done;
+    });
+
+    const auto perRowReads = millisecondsPerIteration (iterations, [&]
+    {
+        const auto num = processor.getNumTasks();
+        int done = 0;
+        for (int i = 0; i < num; ++i)
+            if (processor.getTask (i).done)
+                ++done;
+        sink = done;
+    });
+
+    const auto snapshotReads = millisecondsPerIteration (iterations, [&]
+    {
+        const auto snapshot = processor.getSnapshot();
+        int done = 0;
+        snapshot.visitTasks (0, snapshot.size(), [&] (int, const TaskRef& task)
+        {
+            if (task.done)
+                ++done;
+        });
+        sink = done;
+    });
+
+    const auto paint = millisecondsPerIteration (iterations, [&]
+    {
+        juce::Graphics g (frame);
+        list.paint (g);
+    });
+
+    // The same frame with the viewport scrolled halfway down the list.
+    const auto paintScrolled = millisecondsPerIteration (iterations, [&]
+    {
+        juce::Graphics g (frame);
+        g.setOrigin (0, -list.getHeight() / 2);
+        list.paint (g);
+    });
+
+    result.setProperty ("lockedRowReadsMs", lockedRowReads);
+    result.setProperty ("perRowReadsMs", perRowReads);
+    result.setProperty ("snapshotVisitMs", snapshotReads);
+    result.setProperty ("paintFrameMs", paint);
+    result.setProperty ("paintScrolledFrameMs", paintScrolled);
+}
+
+// Typing "number 4242" into the filter box, one keystroke at a time.
+void benchmarkFilter (int numTasks)
+{
+    TodoListNativeAudioProcessor processor;
+    fillProcessor (processor, numTasks);
+
+    const juce::String typed ("number 4242");
+    const auto iterations = juce::jmax (5, 100000 / numTasks);
+
+    auto& result = addResult ("filter", numTasks);
+    juce::Array<juce::var> queries;
+    TodoListNativeAudioProcessor::FoundTasks previous;
+
+    // typedMs is the same search refined from the previous query's results, as when typing.
+    for (int length = 1; length <= typed.length(); length += 3)
+    {
+        const auto text = typed.substring (0, length);
+        size_t numFound = 0;
+        const auto ms = millisecondsPerIteration (iterations, [&] { numFound = processor.findTasks (text).size(); });
+        const auto typedMs = millisecondsPerIteration (iterations, [&] { numFound = processor.findTasks (text, &previous).size(); });
+        previous = processor.findTasks (text);
+
+        auto* query = new juce::DynamicObject();
+        queries.add (juce::var (query));
+        query->setProperty ("query", text);
+        query->setProperty ("found", (int) numFound);
+        query->setProperty ("ms", ms);
+        query->setProperty ("typedMs", typedMs);
+    }
+
+    result.setProperty ("queries", queries);
+}
+
+// Compares the snapshot's counted tree with the flat juce::Array the tasks used to live in.
+void benchmarkLayouts (int numTasks)
+{
+    juce::Array<TodoTask> flat;
+    for (int i = 0; i < numTasks; ++i)
+        flat.add ({ "benchmark task number " + juce::String (i), false });
+
+    TaskSnapshotBuilder tree ((TaskSnapshot()));
+    tree.setTasks (flat);
+    tree.build();
+
+    TodoListNativeAudioProcessor processor;
+    processor.setAsyncStateLoading (false);
+    processor.applyBatch ([&] (TodoListNativeAudioProcessor::Batch& batch)
+    {
+        for (const auto& task : flat)
+            batch.addTask (task.text);
+    });
+
+    const auto iterations = juce::jmax (20, 2000000 / numTasks);
+    const auto middle = numTasks / 2;
+    int next = 0;
+
+    const auto flatRead = millisecondsPerIteration (iterations, [&] { sink = flat.getReference ((next = (next + 7919) % numTasks)).text.length(); });
+    const auto flatMove = millisecondsPerIteration (iterations, [&] { flat.move (numTasks - 1, 0); });
+    const auto flatRemoveInsert = millisecondsPerIteration (iterations, [&]
+    {
+        auto task = flat.removeAndReturn (middle);
+        flat.insert (middle, std::move (task));
+    });
+
+    const auto treeRead = millisecondsPerIteration (iterations, [&] { sink = tree.getTask ((next = (next + 7919) % numTasks))->numBytes; });
+    const auto treeMove = millisecondsPerIteration (iterations, [&] { tree.move (numTasks - 1, 0); });
+    const auto treeRemoveInsert = millisecondsPerIteration (iterations, [&]
+    {
+        auto task = tree.getTask (middle)->toTask();
+        tree.remove (middle);
+        tree.insert (middle, std::move (task));
+    });
+
+    const auto processorMove = millisecondsPerIteration (iterations, [&] { processor.moveTask (numTasks - 1, 0); });
+
+    auto& result = addResult ("layouts", numTasks);
+    result.setProperty ("flatReadMs", flatRead);
+    result.setProperty ("flatMoveLastToFirstMs", flatMove);
+    result.setProperty ("flatRemoveInsertMiddleMs", flatRemoveInsert);
+    result.setProperty ("treeReadMs", treeRead);
+    result.setProperty ("treeMoveLastToFirstMs", treeMove);
+    result.setProperty ("treeRemoveInsertMiddleMs", treeRemoveInsert);
+    result.setProperty ("processorMoveTaskMs", processorMove);
+}
+
+// Heap held by the tasks themselves, in the flat juce::Array of LegacyTask they used to live
+// in and in a snapshot's column-wise leaves, both when loaded in one go and when built up
+// one insert at a time.
+void benchmarkMemory (int numTasks)
+{
+    struct Usage
+    {
+        size_t bytes = 0, allocations = 0;
+    };
+
+    const auto measure = [] (auto&& build)
+    {
+        const Usage before { liveHeapBytes.load(), liveHeapAllocations.load() };
+        build();
+        return Usage { liveHeapBytes.load() - before.bytes, liveHeapAllocations.load() - before.allocations };
+    };
+
+    juce::Array<LegacyTask> flat;
+    const auto flatUsage = measure ([&]
+    {
+        for (int i = 0; i < numTasks; ++i)
+            flat.add ({ "benchmark task number " + juce::String (i), i % 10 == 0 });
+    });
+
+    juce::Array<TodoTask> tasks;
+    for (const auto& task : flat)
+        tasks.add ({ task.text, task.done });
+
+    TaskSnapshot loaded, inserted;
+    const auto loadedUsage = measure ([&]
+    {
+        TaskSnapshotBuilder builder ((TaskSnapshot()));
+        builder.setTasks (tasks);
+        loaded = builder.build();
+    });
+
+    const auto insertedUsage = measure ([&]
+    {
+        TaskSnapshotBuilder builder ((TaskSnapshot()));
+        for (const auto& task : tasks)
+            builder.insert (builder.size(), task);
+        inserted = builder.build();
+    });
+
+    auto& result = addResult ("memory", numTasks);
+
+    const auto report = [&result] (const char* name, Usage usage)
+    {
+        auto* layout = new juce::DynamicObject();
+        result.setProperty (name, juce::var (layout));
+        layout->setProperty ("bytes", (juce::int64) usage.bytes);
+        layout->setProperty ("allocations", (juce::int64) usage.allocations);
+    };
+
+    report ("flatArray", flatUsage);
+    report ("loadedSnapshot", loadedUsage);
+    report ("insertedSnapshot", insertedUsage);
+}
+
+const char* getFormatName (TodoListNativeAudioProcessor::StateFormat format)
+{
+    return format == TodoListNativeAudioProcessor::StateFormat::binary ? "binary" : "json";
+}
+
+void benchmarkState (int numTasks, TodoListNativeAudioProcessor::StateFormat format)
+{
+    TodoListNativeAudioProcessor processor;
+    fillProcessor (processor, numTasks);
+    processor.setStateFormat (format);
+    processor.setAsyncStateLoading (false);
+
+    auto& result = addResult ("state", numTasks);
+    result.setProperty ("format", getFormatName (format));
+
+    const auto iterations = juce::jmax (3, 100000 / numTasks);
+    juce::MemoryBlock state;
+
+    bool toggle = false;
+    const auto saveMs = millisecondsPerIteration (iterations, [&]
+    {
+        processor.setTaskDone (0, toggle = ! toggle);
+        processor.getStateInformation (state);
+    });
+    const auto cachedSaveMs = millisecondsPerIteration (iterations, [&] { processor.getStateInformation (state); });
+    const auto loadMs = millisecondsPerIteration (iterations, [&] { processor.setStateInformation (state.getData(), (int) state.getSize()); });
+
+    juce::MemoryBlock scratch;
+    processor.setTaskDone (0, ! toggle);
+    const auto savePeak = peakHeapGrowth ([&] { processor.getStateInformation (scratch); });
+    const auto loadPeak = peakHeapGrowth ([&] { processor.setStateInformation (state.getData(), (int) state.getSize()); });
+
+    // A session has to be saved again in the format it was loaded from.
+    TodoListNativeAudioProcessor reloaded;
+    reloaded.setAsyncStateLoading (false);
+    reloaded.setStateInformation (state.getData(), (int) state.getSize());
+    reloaded.addTask ("edited after loading");
+    reloaded.getStateInformation (scratch);
+
+    const auto resavedFormat = std::memcmp (scratch.getData(), "TDLB", 4) == 0 ? TodoListNativeAudioProcessor::StateFormat::binary
+                                                                               : TodoListNativeAudioProcessor::StateFormat::json;
+    if (resavedFormat != format)
+        formatChanged = true;
+
+    result.setProperty ("resavedFormat", getFormatName (resavedFormat));
+    result.setProperty ("stateBytes", (juce::int64) state.getSize());
+    result.setProperty ("saveAfterEditMs", saveMs);
+    result.setProperty ("saveAfterEditPeakHeapBytes", (juce::int64) savePeak);
+    result.setProperty ("unchangedSaveMs", cachedSaveMs);
+    result.setProperty ("loadMs", loadMs);
+    result.setProperty ("loadPeakHeapBytes", (juce::int64) loadPeak);
+}
+} // namespace
+
+// Writes a JSON report to the file named on the command line, or to stdout without one.
+// Progress goes to stderr. Exits with 1 if a loaded state was saved in another format.
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const int sizes[] = { 100, 1000, 10000, 100000, 1000000 };
+
+    for (auto numTasks : sizes)
+        benchmarkEdits (numTasks);
+
+    for (auto numTasks : sizes)
+        for (auto format : { TodoListNativeAudioProcessor::StateFormat::json, TodoListNativeAudioProcessor::StateFormat::binary })
+            benchmarkState (numTasks, format);
+
+    for (auto numTasks : sizes)
+        benchmarkPaint (numTasks);
+
+    for (auto numTasks : sizes)
+        benchmarkFilter (numTasks);
+
+    for (auto numTasks : sizes)
+        benchmarkLayouts (numTasks);
+
+    for (auto numTasks : sizes)
+        benchmarkMemory (numTasks);
+
+    auto* report = new juce::DynamicObject();
+    const juce::var reportVar (report);
+    report->setProperty ("juceVersion", juce::SystemStats::getJUCEVersion());
+    report->setProperty ("os", juce::SystemStats::getOperatingSystemName());
+    report->setProperty ("cpu", juce::SystemStats::getCpuModel());
+    report->setProperty ("numCpus", juce::SystemStats::getNumCpus());
+    report->setProperty ("results", results);
+
+    const auto json = juce::JSON::toString (reportVar);
+
+    if (formatChanged)
+        std::cerr << "a loaded state was saved again in a different format" << std::endl;
+
+    if (argc > 1)
+        return juce::File::getCurrentWorkingDirectory().getChildFile (argv[1]).replaceWithText (json) && ! formatChanged ? 0 : 1;
+
+    std::cout << json << std::endl;
+    return formatChanged ? 1 : 0;
+}
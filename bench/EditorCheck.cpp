@@ -0,0 +1,120 @@
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "PluginEditor.h"
+
+#include <iostream>
+
+namespace
+{
+template <typename ComponentType, typename Predicate>
+ComponentType* findChild (juce::Component& parent, Predicate&& matches)
+{
+    for (auto* child : parent.getChildren())
+    {
+        if (auto* found = dynamic_cast<ComponentType*> (child); found != nullptr && matches (*found))
+            return found;
+
+        if (auto* found = findChild<ComponentType> (*child, matches))
+            return found;
+    }
+
+    return nullptr;
+}
+
+const juce::KeyPress undoKey ('z', juce::ModifierKeys::commandModifier, 0);
+const juce::KeyPress redoKey ('z', juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier, 0);
+} // namespace
+
+// Clicks and key presses go through the editor's window peer, so they reach components
+// the same way a user's would: focus moves on click and keys start at the focused
+// component and bubble up through its parents.
+int main()
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    if (juce::Desktop::getInstance().getDisplays().getPrimaryDisplay() == nullptr)
+    {
+        std::cout << "skipped: no display" << std::endl;
+        return 0;
+    }
+
+    TodoListNativeAudioProcessor processor;
+    processor.addTask ("one");
+    processor.addTask ("two");
+
+    std::unique_ptr<juce::AudioProcessorEditor> editor (processor.createEditor());
+    editor->addToDesktop (0);
+    editor->setVisible (true);
+    auto* peer = editor->getPeer();
+
+    auto* list = findChild<TaskListComponent> (*editor, [] (auto&) { return true; });
+    auto* input = findChild<juce::TextEditor> (*editor, [] (auto& box) { return box.getTextToShowWhenEmpty() != "filter"; });
+
+    if (peer == nullptr || list == nullptr || input == nullptr)
+    {
+        std::cerr << "FAILED: couldn't find the editor's window, task list or input box" << std::endl;
+        return 1;
+    }
+
+    auto numFailures = 0;
+    const auto check = [&numFailures, &processor] (int expectedTasks, const char* what)
+    {
+        if (processor.getNumTasks() == expectedTasks)
+            return;
+
+        ++numFailures;
+        std::cerr << "FAILED: " << what << ": " << processor.getNumTasks() << " tasks, expected " << expectedTasks << std::endl;
+    };
+
+    const auto click = [&] (juce::Component& target, juce::Point<float> position)
+    {
+        const auto inPeer = editor->getLocalPoint (&target, position);
+        const auto time = juce::Time::currentTimeMillis();
+        peer->handleMouseEvent (juce::MouseInputSource::InputSourceType::mouse, inPeer, juce::ModifierKeys::leftButtonModifier,
+                                juce::MouseInputSource::defaultPressure, juce::MouseInputSource::defaultOrientation, time);
+        peer->handleMouseEvent (juce::MouseInputSource::InputSourceType::mouse, inPeer, juce::ModifierKeys(),
+                                juce::MouseInputSource::defaultPressure, juce::MouseInputSource::defaultOrientation, time + 50);
+    };
+
+    click (*list, { (float) list->getWidth() * 0.5f, 16.0f });
+
+    if (! list->hasKeyboardFocus (false))
+    {
+        ++numFailures;
+        std::cerr << "FAILED: clicking the list didn't give it keyboard focus" << std::endl;
+    }
+
+    peer->handleKeyPress (undoKey);
+    check (1, "undo with the list focused");
+    peer->handleKeyPress (redoKey);
+    check (2, "redo with the list focused");
+
+    click (*input, input->getLocalBounds().getCentre().toFloat());
+    input->setText ("three");
+    peer->handleKeyPress (juce::KeyPress (juce::KeyPress::returnKey));
+
+    // The input box handles return asynchronously, so the rest runs after it has.
+    juce::MessageManager::callAsync ([&]
+    {
+        check (3, "return in the input box");
+
+        peer->handleKeyPress (undoKey);
+        check (2, "undo with the empty input box focused");
+        peer->handleKeyPress (redoKey);
+        check (3, "redo with the empty input box focused");
+
+        input->setText ("draft");
+        peer->handleKeyPress (undoKey);
+        check (3, "undo with text in the input box");
+
+        juce::MessageManager::getInstance()->stopDispatchLoop();
+    });
+
+    juce::MessageManager::getInstance()->runDispatchLoop();
+
+    editor->removeFromDesktop();
+    editor.reset();
+
+    std::cout << (numFailures == 0 ? "passed" : juce::String (numFailures) + " checks failed") << std::endl;
+    return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,303 @@
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "PerfTrace.h"
+#include "RealtimeGuard.h"
+
+#include <iostream>
+#include <thread>
+
+#if ! TODOLIST_REALTIME_GUARD
+ #error "The real-time check needs TODOLIST_REALTIME_GUARD=1"
+#endif
+
+//==============================================================================
+// The real-time guard replaces operator new itself. Locks, system calls and, with glibc,
+// malloc and friends are caught by interposing the functions that make them; each one checks
+// the calling thread and then calls through to the real thing. On Linux that covers calls
+// from the C++ and C libraries too; on macOS only calls from this executable, JUCE included.
+#if JUCE_LINUX || JUCE_MAC
+ #include <dlfcn.h>
+ #include <pthread.h>
+ #include <sched.h>
+ #include <unistd.h>
+
+namespace
+{
+// The cached pointers are constant-initialised, so there's no static guard that could itself
+// take a lock.
+template <typename Function>
+Function* findNext (std::atomic<void*>& cached, const char* name)
+{
+    auto* function = cached.load (std::memory_order_acquire);
+
+    if (function == nullptr)
+    {
+        function = dlsym (RTLD_NEXT, name);
+        cached.store (function, std::memory_order_release);
+    }
+
+    return reinterpret_cast<Function*> (function);
+}
+} // namespace
+
+ #define TODOLIST_INTERPOSE(returnType, name, violation, parameters, arguments)                     \
+    extern "C" returnType name parameters                                                          \
+    {                                                                                               \
+        RealtimeGuard::check (RealtimeGuard::Violation::violation, #name);                          \
+        static std::atomic<void*> next { nullptr };                                                 \
+        return findNext<returnType parameters> (next, #name) arguments;                             \
+    }
+
+TODOLIST_INTERPOSE (int, pthread_mutex_lock, lock, (pthread_mutex_t* mutex), (mutex))
+TODOLIST_INTERPOSE (int, pthread_rwlock_rdlock, lock, (pthread_rwlock_t* lock), (lock))
+TODOLIST_INTERPOSE (int, pthread_rwlock_wrlock, lock, (pthread_rwlock_t* lock), (lock))
+TODOLIST_INTERPOSE (ssize_t, read, systemCall, (int fd, void* data, size_t size), (fd, data, size))
+TODOLIST_INTERPOSE (ssize_t, write, systemCall, (int fd, const void* data, size_t size), (fd, data, size))
+TODOLIST_INTERPOSE (int, nanosleep, systemCall, (const timespec* duration, timespec* remaining), (duration, remaining))
+TODOLIST_INTERPOSE (int, usleep, systemCall, (useconds_t microseconds), (microseconds))
+TODOLIST_INTERPOSE (int, sched_yield, systemCall, (), ())
+
+ #undef TODOLIST_INTERPOSE
+
+ #if JUCE_LINUX && defined (__GLIBC__)
+// dlsym itself allocates, so these call glibc's own entry points instead.
+extern "C" void* __libc_malloc (size_t);
+extern "C" void* __libc_calloc (size_t, size_t);
+extern "C" void* __libc_realloc (void*, size_t);
+extern "C" void __libc_free (void*);
+
+extern "C" void* malloc (size_t size)
+{
+    RealtimeGuard::check (RealtimeGuard::Violation::allocation, "malloc");
+    return __libc_malloc (size);
+}
+
+extern "C" void* calloc (size_t count, size_t size)
+{
+    RealtimeGuard::check (RealtimeGuard::Violation::allocation, "calloc");
+    return __libc_calloc (count, size);
+}
+
+extern "C" void* realloc (void* block, size_t size)
+{
+    RealtimeGuard::check (RealtimeGuard::Violation::allocation, "realloc");
+    return __libc_realloc (block, size);
+}
+
+extern "C" void free (void* block)
+{
+    if (block != nullptr)
+        RealtimeGuard::check (RealtimeGuard::Violation::deallocation, "free");
+
+    __libc_free (block);
+}
+ #endif
+#endif
+
+//==============================================================================
+namespace
+{
+// Makes sure the hooks are live before trusting a clean run: each of these must be caught,
+// while another thread allocating at the same time mustn't be. The pointers are volatile so
+// that the compiler can't leave the allocations out.
+bool hooksCatchViolations()
+{
+    struct alignas (64) Aligned { char bytes[64]; };
+
+    std::atomic<int> stage { 0 };
+    std::thread other ([&stage]
+    {
+        while (stage.load() == 0) {}
+
+        int* volatile allocated = new int (0);
+        delete allocated;
+        stage = 2;
+    });
+
+    RealtimeGuard::clearViolations();
+
+    {
+        const RealtimeGuard::ScopedRealtimeSection section;
+        stage = 1;
+
+        while (stage.load() != 2) {}
+    }
+
+    other.join();
+
+    if (RealtimeGuard::getNumViolations() != 0)
+        return false;
+
+    const auto isCaught = [] (auto&& violation)
+    {
+        RealtimeGuard::clearViolations();
+
+        {
+            const RealtimeGuard::ScopedRealtimeSection section;
+            violation();
+        }
+
+        const auto numCaught = RealtimeGuard::getNumViolations();
+        RealtimeGuard::clearViolations();
+        return numCaught > 0;
+    };
+
+    int* volatile allocated = nullptr;
+    Aligned* volatile aligned = nullptr;
+    const juce::CriticalSection lock;
+
+    return isCaught ([&] { allocated = new int (0); })
+        && isCaught ([&] { delete allocated; })
+        && isCaught ([&] { aligned = new Aligned(); })
+        && isCaught ([&] { delete aligned; })
+        && isCaught ([&] { allocated = new (std::nothrow) int (0); })
+        && isCaught ([&] { operator delete (allocated, std::nothrow); })
+        && isCaught ([&] { const PerfTrace::TimedScopedLock sl (lock, "canary lock"); });
+}
+
+// Moves on a little every time it's asked, like a playing transport.
+class CheckPlayHead final : public juce::AudioPlayHead
+{
+public:
+    juce::Optional<PositionInfo> getPosition() const override
+    {
+        const auto seconds = (double) ++numCalls / 100.0;
+
+        PositionInfo info;
+        info.setTimeInSeconds (seconds);
+        info.setPpqPosition (seconds * 2.0);
+        info.setBarCount ((juce::int64) (seconds / 2.0));
+        return info;
+    }
+
+private:
+    mutable std::atomic<juce::int64> numCalls { 0 };
+};
+
+template <typename SampleType>
+void renderBlocks (TodoListNativeAudioProcessor& processor, int numChannels, int blockSize, int numBlocks)
+{
+    processor.setPlayConfigDetails (numChannels, numChannels, 48000.0, blockSize);
+    processor.prepareToPlay (48000.0, blockSize);
+
+    juce::AudioBuffer<SampleType> buffer (numChannels, blockSize);
+    juce::MidiBuffer midi;
+    midi.ensureSize (1024);
+
+    for (int block = 0; block < numBlocks; ++block)
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            juce::FloatVectorOperations::fill (buffer.getWritePointer (channel), (SampleType) block, blockSize);
+
+        processor.processBlock (buffer, midi);
+
+        // A host's callback leaves gaps between blocks too, in which the message thread gets
+        // to request markers and collect their stamps.
+        std::this_thread::sleep_for (std::chrono::microseconds (50));
+    }
+
+    processor.releaseResources();
+}
+} // namespace
+
+// Usage: TodoListRealtimeCheck [--blocks=N] [--trap]
+//
+// Renders blocks at several channel counts, block sizes and both precisions on an audio
+// thread of its own, while the main thread runs the message loop and another thread edits
+// the list, saves and loads the state and switches tracing on and off. Markers are requested
+// on the message thread, as the editor does, and every marker task that comes back must have
+// the position it was stamped with. Exits with 1 if processBlock did anything it mustn't or a
+// marker came back without a position; with --trap it aborts at the first violation instead,
+// for a debugger to catch.
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const juce::ArgumentList args (argc, argv);
+    const auto blocksOption = args.getValueForOption ("--blocks");
+    const auto numBlocks = blocksOption.isNotEmpty() ? juce::jmax (1, blocksOption.getIntValue()) : 4000;
+
+    if (! hooksCatchViolations())
+    {
+        std::cerr << "the real-time hooks aren't catching anything" << std::endl;
+        return 1;
+    }
+
+    if (args.containsOption ("--trap"))
+        RealtimeGuard::setResponse (RealtimeGuard::Response::trap);
+
+    CheckPlayHead playHead;
+    TodoListNativeAudioProcessor processor;
+    processor.setPlayHead (&playHead);
+    processor.applyBatch ([] (TodoListNativeAudioProcessor::Batch& batch)
+    {
+        for (int i = 0; i < 1000; ++i)
+            batch.addTask ("realtime check task number " + juce::String (i));
+    });
+
+    std::atomic<bool> shouldStop { false };
+    std::thread editor ([&]
+    {
+        juce::Random random (1);
+        juce::MemoryBlock state;
+
+        for (int i = 0; ! shouldStop.load(); ++i)
+        {
+            processor.addTask ("edit " + juce::String (i));
+            processor.setTaskDone (random.nextInt (processor.getNumTasks()), random.nextBool());
+            processor.removeTask (random.nextInt (processor.getNumTasks()));
+
+            if (i % 50 == 0)
+            {
+                processor.getStateInformation (state);
+                processor.setStateInformation (state.getData(), (int) state.getSize());
+                PerfTrace::setEnabled (! PerfTrace::isEnabled());
+
+                juce::MessageManager::callAsync ([&processor, i] { processor.requestMarker ("marker " + juce::String (i)); });
+            }
+        }
+    });
+
+    std::thread audio ([&]
+    {
+        for (auto numChannels : { 1, 2, 6 })
+        {
+            for (auto blockSize : { 32, 512, 4096 })
+            {
+                renderBlocks<float> (processor, numChannels, blockSize, numBlocks);
+                renderBlocks<double> (processor, numChannels, blockSize, numBlocks);
+            }
+        }
+
+        juce::MessageManager::getInstance()->stopDispatchLoop();
+    });
+
+    juce::MessageManager::getInstance()->runDispatchLoop();
+    audio.join();
+    shouldStop = true;
+    editor.join();
+    PerfTrace::setEnabled (false);
+
+    const auto numViolations = RealtimeGuard::getNumViolations();
+
+    for (const auto& report : RealtimeGuard::getReports())
+        std::cerr << RealtimeGuard::getName (report.violation) << ": " << report.what << std::endl;
+
+    auto numMarkers = 0, numWithoutPosition = 0;
+    const auto snapshot = processor.getSnapshot();
+
+    snapshot.visitTasks (0, snapshot.size(), [&] (int, const TaskRef& task)
+    {
+        if (task.getText().startsWith ("marker "))
+        {
+            ++numMarkers;
+
+            if (task.position == nullptr)
+                ++numWithoutPosition;
+        }
+    });
+
+    std::cout << numViolations << " real-time violations in " << numBlocks * 18 << " blocks" << std::endl;
+    std::cout << numMarkers << " markers, " << numWithoutPosition << " without a position" << std::endl;
+    return numViolations == 0 && numMarkers > 0 && numWithoutPosition == 0 ? 0 : 1;
+}
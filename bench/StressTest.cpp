@@ -0,0 +1,375 @@
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "PerfTrace.h"
+
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <thread>
+
+namespace
+{
+thread_local volatile int sink = 0;
+
+/** Latencies counted in log-scaled buckets, eight to each power of two, so that recording
+    one costs the same however long the run is. Percentiles come out as the top of the
+    bucket they fall in, which is within an eighth of the true value.
+*/
+class LatencyHistogram
+{
+public:
+    void record (juce::uint64 nanoseconds) noexcept
+    {
+        ++counts[getBucket (nanoseconds)];
+        ++count;
+        total += nanoseconds;
+        maximum = juce::jmax (maximum, nanoseconds);
+    }
+
+    void merge (const LatencyHistogram& other) noexcept
+    {
+        for (size_t i = 0; i < counts.size(); ++i)
+            counts[i] += other.counts[i];
+
+        count += other.count;
+        total += other.total;
+        maximum = juce::jmax (maximum, other.maximum);
+    }
+
+    juce::uint64 getCount() const noexcept      { return count; }
+    juce::uint64 getMaximum() const noexcept    { return maximum; }
+    double getMean() const noexcept             { return count > 0 ? (double) total / (double) count : 0.0; }
+
+    juce::uint64 getPercentile (double fraction) const noexcept
+    {
+        const auto target = juce::jmax ((juce::uint64) 1, (juce::uint64) std::ceil (fraction * (double) count));
+        juce::uint64 seen = 0;
+
+        for (size_t bucket = 0; bucket < counts.size(); ++bucket)
+            if ((seen += counts[bucket]) >= target)
+                return juce::jmin (maximum, getUpperBound (bucket));
+
+        return maximum;
+    }
+
+private:
+    static constexpr int bucketsPerPowerOfTwo = 8;
+
+    std::array<juce::uint64, 64 * bucketsPerPowerOfTwo> counts {};
+    juce::uint64 count = 0, total = 0, maximum = 0;
+
+    static int getExponent (juce::uint64 value) noexcept
+    {
+        int exponent = 0;
+        while ((value >> (exponent + 1)) != 0)
+            ++exponent;
+        return exponent;
+    }
+
+    // Values below eight get a bucket each; above that, the three bits after the highest
+    // set bit pick one of the eight buckets for that power of two.
+    static size_t getBucket (juce::uint64 value) noexcept
+    {
+        if (value < bucketsPerPowerOfTwo)
+            return (size_t) value;
+
+        const auto exponent = getExponent (value);
+        const auto mantissa = (value >> (exponent - 3)) & (bucketsPerPowerOfTwo - 1);
+        return (size_t) ((exponent - 2) * bucketsPerPowerOfTwo) + (size_t) mantissa;
+    }
+
+    static juce::uint64 getUpperBound (size_t bucket) noexcept
+    {
+        if (bucket < bucketsPerPowerOfTwo)
+            return bucket;
+
+        const auto exponent = (int) (bucket / bucketsPerPowerOfTwo) + 2;
+        const auto mantissa = (juce::uint64) (bucket % bucketsPerPowerOfTwo);
+        return ((bucketsPerPowerOfTwo + mantissa + 1) << (exponent - 3)) - 1;
+    }
+};
+
+struct Operation
+{
+    const char* name;
+    int weight;
+    std::function<void (TodoListNativeAudioProcessor&, juce::Random&, const juce::MemoryBlock& savedState)> run;
+};
+
+int pickIndex (TodoListNativeAudioProcessor& processor, juce::Random& random)
+{
+    return random.nextInt (juce::jmax (1, processor.getNumTasks()));
+}
+
+// A mix of what the host's save thread, the editor and scripts do to the processor. Adds
+// and removals are weighted equally, so the list stays around the size it started at.
+const std::vector<Operation>& getOperations()
+{
+    using Processor = TodoListNativeAudioProcessor;
+
+    static const std::vector<Operation> operations
+    {
+        { "getStateInformation", 2, [] (Processor& p, juce::Random&, const juce::MemoryBlock&)
+          {
+              juce::MemoryBlock state;
+              p.getStateInformation (state);
+              sink = (int) state.getSize();
+          } },
+        { "setStateInformation", 1, [] (Processor& p, juce::Random&, const juce::MemoryBlock& savedState)
+          {
+              p.setStateInformation (savedState.getData(), (int) savedState.getSize());
+          } },
+        { "getNumTasks", 16, [] (Processor& p, juce::Random&, const juce::MemoryBlock&) { sink = p.getNumTasks(); } },
+        { "getTask", 16, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&) { sink = p.getTask (pickIndex (p, r)).text.length(); } },
+        { "getStats", 8, [] (Processor& p, juce::Random&, const juce::MemoryBlock&) { sink = p.getStats().done; } },
+        { "getCollapsed", 8, [] (Processor& p, juce::Random&, const juce::MemoryBlock&) { sink = p.getCollapsed() ? 1 : 0; } },
+        { "visitSnapshot", 4, [] (Processor& p, juce::Random&, const juce::MemoryBlock&)
+          {
+              const auto snapshot = p.getSnapshot();
+              int done = 0;
+              snapshot.visitTasks (0, snapshot.size(), [&] (int, const TaskRef& task)
+              {
+                  if (task.done)
+                      ++done;
+              });
+              sink = done;
+          } },
+        { "findTasks", 2, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&)
+          {
+              sink = (int) p.findTasks ("number " + juce::String (r.nextInt (1000))).size();
+          } },
+        { "addTask", 8, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&) { p.addTask ("stress task " + juce::String (r.nextInt())); } },
+        { "removeTask", 8, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&) { p.removeTask (pickIndex (p, r)); } },
+        { "moveTask", 8, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&) { p.moveTask (pickIndex (p, r), pickIndex (p, r)); } },
+        { "setTaskDone", 8, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&) { p.setTaskDone (pickIndex (p, r), r.nextBool()); } },
+        { "setCollapsed", 2, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&) { p.setCollapsed (r.nextBool()); } },
+        { "applyBatch", 2, [] (Processor& p, juce::Random& r, const juce::MemoryBlock&)
+          {
+              p.applyBatch ([&r] (Processor::Batch& batch)
+              {
+                  batch.addTask ("stress batch task " + juce::String (r.nextInt()));
+                  batch.moveTask (batch.getNumTasks() - 1, r.nextInt (batch.getNumTasks()));
+                  batch.removeTask (r.nextInt (batch.getNumTasks()));
+              });
+          } },
+        { "undo", 2, [] (Processor& p, juce::Random&, const juce::MemoryBlock&) { p.undo(); } },
+        { "redo", 2, [] (Processor& p, juce::Random&, const juce::MemoryBlock&) { p.redo(); } },
+    };
+
+    return operations;
+}
+
+using Histograms = std::vector<LatencyHistogram>;
+
+/** How long the processor's threads waited for each of its locks, as the TimedScopedLocks
+    recorded it in the trace buffers. The buffers are rings, so they're read often enough
+    during the run that no thread can wrap its own before the next look.
+*/
+class LockWaits
+{
+public:
+    struct Totals
+    {
+        juce::int64 count = 0, totalTicks = 0, maxTicks = 0;
+    };
+
+    explicit LockWaits (juce::int64 startTicks) : start (startTicks) {}
+
+    void collect()
+    {
+        for (const auto& sample : PerfTrace::collectSamples())
+        {
+            // Each thread's samples come out in the order they ended, and a sample can stay
+            // in the buffer across several looks.
+            auto& lastEnd = lastEndTicks.try_emplace (sample.threadIndex, start).first->second;
+            if (sample.endTicks <= lastEnd)
+                continue;
+
+            lastEnd = sample.endTicks;
+
+            if (sample.name == nullptr || ! isLockWait (sample.name))
+                continue;
+
+            auto& totals = byLock[sample.name];
+            const auto ticks = sample.endTicks - sample.startTicks;
+            ++totals.count;
+            totals.totalTicks += ticks;
+            totals.maxTicks = juce::jmax (totals.maxTicks, ticks);
+        }
+    }
+
+    const std::map<juce::String, Totals>& getTotals() const noexcept    { return byLock; }
+
+private:
+    juce::int64 start;
+    std::map<int, juce::int64> lastEndTicks;
+    std::map<juce::String, Totals> byLock;
+
+    static bool isLockWait (const char* name)
+    {
+        return std::strcmp (name, "writeLock wait") == 0 || std::strcmp (name, "stateCacheLock wait") == 0;
+    }
+};
+
+struct StressResults
+{
+    Histograms latencies;
+    LockWaits lockWaits;
+};
+
+// Runs the operation mix from the given number of threads against one processor, and
+// returns each operation's latencies from all of them together, along with the time they
+// spent waiting for the processor's locks.
+StressResults runStress (int numThreads, double seconds, int numTasks)
+{
+    TodoListNativeAudioProcessor processor;
+    processor.applyBatch ([numTasks] (TodoListNativeAudioProcessor::Batch& batch)
+    {
+        for (int i = 0; i < numTasks; ++i)
+            batch.addTask ("stress task number " + juce::String (i));
+    });
+
+    juce::MemoryBlock savedState;
+    processor.getStateInformation (savedState);
+
+    const auto& operations = getOperations();
+    int totalWeight = 0;
+    for (const auto& operation : operations)
+        totalWeight += operation.weight;
+
+    const auto nanosecondsPerTick = 1.0e9 / (double) juce::Time::getHighResolutionTicksPerSecond();
+    std::atomic<bool> shouldStop { false };
+    std::vector<Histograms> perThread ((size_t) numThreads, Histograms (operations.size()));
+    std::vector<std::thread> threads;
+    LockWaits lockWaits (juce::Time::getHighResolutionTicks());
+
+    for (int i = 0; i < numThreads; ++i)
+    {
+        threads.emplace_back ([&, i]
+        {
+            juce::Random random (i + 1);
+            auto& histograms = perThread[(size_t) i];
+
+            while (! shouldStop.load (std::memory_order_relaxed))
+            {
+                auto pick = random.nextInt (totalWeight);
+                size_t index = 0;
+                while (pick >= operations[index].weight)
+                    pick -= operations[index++].weight;
+
+                const auto start = juce::Time::getHighResolutionTicks();
+                operations[index].run (processor, random, savedState);
+                const auto elapsed = juce::Time::getHighResolutionTicks() - start;
+                histograms[index].record ((juce::uint64) ((double) elapsed * nanosecondsPerTick));
+            }
+        });
+    }
+
+    const auto end = std::chrono::steady_clock::now() + std::chrono::duration<double> (seconds);
+
+    while (std::chrono::steady_clock::now() < end)
+    {
+        std::this_thread::sleep_for (std::chrono::milliseconds (10));
+        lockWaits.collect();
+    }
+
+    shouldStop = true;
+
+    for (auto& thread : threads)
+        thread.join();
+
+    lockWaits.collect();
+
+    Histograms merged (operations.size());
+    for (const auto& histograms : perThread)
+        for (size_t i = 0; i < merged.size(); ++i)
+            merged[i].merge (histograms[i]);
+
+    return { std::move (merged), std::move (lockWaits) };
+}
+
+double toMicroseconds (double nanoseconds)
+{
+    return nanoseconds / 1000.0;
+}
+} // namespace
+
+// Usage: TodoListStressTest [--threads=N] [--seconds=S] [--tasks=N] [--output=file.json]
+//
+// The mix is run once from a single thread and then from all of them. Tracing is on for
+// both runs, so that the time spent waiting for each of the processor's locks comes from
+// the timed lock scopes rather than from how much slower the operations got, which would
+// also count the threads competing for the CPU.
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    PerfTrace::setEnabled (true);
+
+    const juce::ArgumentList args (argc, argv);
+    const auto getOption = [&args] (const juce::String& option, int defaultValue)
+    {
+        const auto value = args.getValueForOption (option);
+        return value.isNotEmpty() ? value.getIntValue() : defaultValue;
+    };
+
+    const auto numThreads = juce::jmax (2, getOption ("--threads", juce::SystemStats::getNumCpus()));
+    const auto seconds = (double) juce::jmax (1, getOption ("--seconds", 5));
+    const auto numTasks = juce::jmax (1, getOption ("--tasks", 1000));
+
+    std::cerr << "1 thread for " << seconds / 4.0 << " s" << std::endl;
+    const auto alone = runStress (1, seconds / 4.0, numTasks);
+
+    std::cerr << numThreads << " threads for " << seconds << " s" << std::endl;
+    const auto contended = runStress (numThreads, seconds, numTasks);
+
+    const auto& operations = getOperations();
+    const auto ticksToMicroseconds = [] (double ticks) { return ticks * 1.0e6 / (double) juce::Time::getHighResolutionTicksPerSecond(); };
+    juce::Array<juce::var> results, lockWaits;
+
+    for (size_t i = 0; i < operations.size(); ++i)
+    {
+        const auto& latencies = contended.latencies[i];
+
+        auto* result = new juce::DynamicObject();
+        results.add (juce::var (result));
+        result->setProperty ("operation", operations[i].name);
+        result->setProperty ("count", (juce::int64) latencies.getCount());
+        result->setProperty ("perSecond", (double) latencies.getCount() / seconds);
+        result->setProperty ("meanUs", toMicroseconds (latencies.getMean()));
+        result->setProperty ("p50Us", toMicroseconds ((double) latencies.getPercentile (0.5)));
+        result->setProperty ("p99Us", toMicroseconds ((double) latencies.getPercentile (0.99)));
+        result->setProperty ("maxUs", toMicroseconds ((double) latencies.getMaximum()));
+        result->setProperty ("aloneMeanUs", toMicroseconds (alone.latencies[i].getMean()));
+    }
+
+    for (const auto& [name, totals] : contended.lockWaits.getTotals())
+    {
+        auto* wait = new juce::DynamicObject();
+        lockWaits.add (juce::var (wait));
+        wait->setProperty ("scope", name);
+        wait->setProperty ("count", totals.count);
+        wait->setProperty ("meanUs", ticksToMicroseconds ((double) totals.totalTicks / (double) totals.count));
+        wait->setProperty ("maxUs", ticksToMicroseconds ((double) totals.maxTicks));
+    }
+
+    auto* report = new juce::DynamicObject();
+    const juce::var reportVar (report);
+    report->setProperty ("juceVersion", juce::SystemStats::getJUCEVersion());
+    report->setProperty ("os", juce::SystemStats::getOperatingSystemName());
+    report->setProperty ("cpu", juce::SystemStats::getCpuModel());
+    report->setProperty ("threads", numThreads);
+    report->setProperty ("seconds", seconds);
+    report->setProperty ("initialTasks", numTasks);
+    report->setProperty ("operations", results);
+    report->setProperty ("lockWaits", lockWaits);
+
+    const auto json = juce::JSON::toString (reportVar);
+    const auto outputPath = args.getValueForOption ("--output");
+
+    if (outputPath.isNotEmpty())
+        return juce::File::getCurrentWorkingDirectory().getChildFile (outputPath).replaceWithText (json) ? 0 : 1;
+
+    std::cout << json << std::endl;
+    return 0;
+}
@@ -0,0 +1,435 @@
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+#include <iostream>
+#include <set>
+
+namespace
+{
+struct Model
+{
+    juce::Array<TodoTask> tasks;
+    juce::StringArray archived;
+    bool collapsed = false;
+};
+
+class Checker
+{
+public:
+    void check (bool condition, const juce::String& what)
+    {
+        if (condition)
+            return;
+
+        if (++numFailures <= 20)
+            std::cerr << "FAILED: " << what << " (" << context << ")" << std::endl;
+    }
+
+    juce::String context;
+    int numFailures = 0;
+};
+
+bool samePosition (const std::optional<TaskPosition>& a, const std::optional<TaskPosition>& b, double tolerance)
+{
+    if (! a || ! b)
+        return a.has_value() == b.has_value();
+
+    const auto sameValue = [tolerance] (const auto& x, const auto& y)
+    {
+        if (! x || ! y)
+            return x.has_value() == y.has_value();
+
+        return std::abs ((double) *x - (double) *y) <= tolerance;
+    };
+
+    return sameValue (a->timeInSeconds, b->timeInSeconds) && sameValue (a->ppq, b->ppq) && sameValue (a->bar, b->bar);
+}
+
+juce::String randomText (juce::Random& random)
+{
+    static const char* const words[] = { "mix", "vocal", "bass", "drums", "\xc3\xa9q", "comp", "bus", "\xe2\x99\xaa", "take" };
+
+    juce::String text;
+    const auto numWords = 1 + random.nextInt (4);
+
+    for (int i = 0; i < numWords; ++i)
+        text << (i > 0 ? " " : "") << juce::CharPointer_UTF8 (words[random.nextInt (juce::numElementsInArray (words))]);
+
+    return text << " " << random.nextInt (1000);
+}
+
+std::optional<TaskPosition> randomPosition (juce::Random& random)
+{
+    if (random.nextInt (3) != 0)
+        return std::nullopt;
+
+    TaskPosition position;
+
+    if (random.nextBool())
+        position.timeInSeconds = random.nextInt (1000000) / 1000.0;
+    if (random.nextBool())
+        position.ppq = random.nextInt (1000000) / 64.0;
+    if (random.nextBool() || position.isEmpty())
+        position.bar = random.nextInt (10000);
+
+    return position;
+}
+
+TaskStats getModelStats (const Model& model)
+{
+    TaskStats stats;
+
+    for (const auto& task : model.tasks)
+    {
+        ++stats.total;
+        stats.done += task.done ? 1 : 0;
+        stats.textBytes += (juce::int64) task.text.getNumBytesAsUTF8();
+
+        if (! task.done && (stats.oldestOpenTask == TaskId::invalid || task.id < stats.oldestOpenTask))
+            stats.oldestOpenTask = task.id;
+    }
+
+    stats.active = stats.total - stats.done;
+    stats.archived = model.archived.size();
+    return stats;
+}
+
+void checkSnapshot (Checker& checker, const TaskSnapshot& snapshot, const Model& model, juce::Random& random, bool checkArchivedText)
+{
+    checker.check (snapshot.size() == model.tasks.size(), "size " + juce::String (snapshot.size()) + " != " + juce::String (model.tasks.size()));
+    checker.check (snapshot.getCollapsed() == model.collapsed, "collapsed");
+
+    for (int i = 0; i < model.tasks.size(); ++i)
+    {
+        const auto task = snapshot.getTask (i);
+        const auto& expected = model.tasks.getReference (i);
+
+        checker.check (task && task->getText() == expected.text && task->done == expected.done && task->id == expected.id,
+                       "task " + juce::String (i));
+        checker.check (task && samePosition (task->position != nullptr ? std::optional<TaskPosition> (*task->position) : std::nullopt, expected.position, 0.0),
+                       "position " + juce::String (i));
+    }
+
+    checker.check (! snapshot.getTask (model.tasks.size()) && ! snapshot.getTask (-1), "out of range");
+
+    const auto start = random.nextInt (model.tasks.size() + 1);
+    const auto end = start + random.nextInt (model.tasks.size() - start + 2);
+    auto next = start;
+
+    snapshot.visitTasks (start, end, [&] (int index, const TaskRef& task)
+    {
+        checker.check (index == next++ && task.id == model.tasks.getReference (index).id, "visit " + juce::String (index));
+    });
+
+    checker.check (next == juce::jmin (end, model.tasks.size()), "visit range");
+
+    const auto stats = snapshot.getStats();
+    const auto expected = getModelStats (model);
+    checker.check (stats.total == expected.total && stats.done == expected.done && stats.active == expected.active, "stats counts");
+    checker.check (stats.textBytes == expected.textBytes, "stats textBytes");
+    checker.check (stats.oldestOpenTask == expected.oldestOpenTask, "stats oldestOpenTask");
+    checker.check (stats.archived == expected.archived, "stats archived");
+    checker.check (snapshot.getArchive() != nullptr && snapshot.getArchive()->size() == model.archived.size(), "archive size");
+
+    if (checkArchivedText)
+        checker.check (snapshot.getArchive()->loadTasks() == model.archived, "archive");
+}
+
+void checkIdIndex (Checker& checker, const TaskIdIndex& idIndex, const TaskSnapshot& snapshot, const Model& model, const std::vector<TaskId>& removedIds, juce::Random& random)
+{
+    for (int i = 0; i < model.tasks.size(); ++i)
+        checker.check (idIndex.indexOf (snapshot, model.tasks.getReference (i).id) == i, "indexOf " + juce::String (i));
+
+    for (int i = 0; i < juce::jmin (100, (int) removedIds.size()); ++i)
+    {
+        const auto id = removedIds[(size_t) random.nextInt ((int) removedIds.size())];
+        checker.check (idIndex.indexOf (snapshot, id) == -1, "indexOf removed " + juce::String ((juce::int64) id));
+    }
+}
+
+// Random edits against a builder and a flat array. The target size swings between empty
+// and a few thousand tasks so that leaves and branches split, merge and collapse. Long
+// bursts of inserts at the front keep splitting the first leaf, which uses up the gap
+// between its label and the next one and forces a relabel.
+void checkTree (Checker& checker, juce::int64 seed, int numRounds)
+{
+    juce::Random random (seed);
+    TaskIdIndex idIndex;
+    TaskSnapshot snapshot;
+    Model model;
+    std::vector<TaskId> removedIds;
+    std::set<TaskId> usedIds;
+    auto previousSnapshot = snapshot;
+    auto previousModel = model;
+
+    const auto removeFromModel = [&] (int index)
+    {
+        removedIds.push_back (model.tasks.getReference (index).id);
+        model.tasks.remove (index);
+    };
+
+    for (int round = 0; round < numRounds; ++round)
+    {
+        checker.context = "seed " + juce::String (seed) + ", round " + juce::String (round);
+
+        const auto targetSize = (int) (3000.0 * std::abs (std::sin (round * 0.05)));
+        TaskSnapshotBuilder builder (snapshot, &idIndex);
+        const auto numEdits = 1 + random.nextInt (200);
+
+        for (int edit = 0; edit < numEdits; ++edit)
+        {
+            const auto size = model.tasks.size();
+            const auto choice = random.nextInt (100);
+
+            if (choice < 40 && size <= targetSize)
+            {
+                const auto isLongBurst = random.nextInt (100) == 0;
+                const auto burst = isLongBurst ? 1200 : (random.nextInt (10) == 0 ? 64 : 1);
+                const auto index = isLongBurst ? 0 : random.nextInt (size + 1);
+
+                for (int i = 0; i < burst; ++i)
+                {
+                    TodoTask task { randomText (random), random.nextBool(), TaskId::invalid, randomPosition (random) };
+                    task.id = builder.insert (index, task);
+                    checker.check (task.id != TaskId::invalid && usedIds.insert (task.id).second, "new ID");
+                    model.tasks.insert (index, task);
+                }
+            }
+            else if (choice < 65 && size > 0)
+            {
+                const auto index = random.nextInt (size);
+                const auto count = random.nextInt (10) == 0 ? juce::jmin (size - index, 1 + random.nextInt (100)) : 1;
+
+                for (int i = 0; i < count; ++i)
+                {
+                    builder.remove (index);
+                    removeFromModel (index);
+                }
+            }
+            else if (choice < 75 && size > 0)
+            {
+                const auto from = random.nextInt (size);
+                const auto to = random.nextInt (size);
+                builder.move (from, to);
+                model.tasks.move (from, to);
+            }
+            else if (choice < 88 && size > 0)
+            {
+                const auto index = random.nextInt (size);
+                const auto done = random.nextBool();
+                builder.setDone (index, done);
+                model.tasks.getReference (index).done = done;
+            }
+            else if (choice < 91)
+            {
+                const auto modulus = (juce::uint64) (2 + random.nextInt (5));
+                const auto shouldRemove = [modulus] (TaskId id) { return (juce::uint64) id % modulus == 0; };
+                auto expected = 0;
+
+                for (int i = model.tasks.size(); --i >= 0;)
+                {
+                    if (shouldRemove (model.tasks.getReference (i).id))
+                    {
+                        removeFromModel (i);
+                        ++expected;
+                    }
+                }
+
+                checker.check (builder.removeIf ([&] (const TaskRef& task) { return shouldRemove (task.id); }) == expected, "removeIf count");
+            }
+            else if (choice < 94)
+            {
+                juce::StringArray texts;
+
+                for (int i = model.tasks.size(); --i >= 0;)
+                {
+                    if (model.tasks.getReference (i).done)
+                    {
+                        texts.insert (0, model.tasks.getReference (i).text);
+                        removeFromModel (i);
+                    }
+                }
+
+                model.archived.addArray (texts);
+                checker.check (builder.archiveIf ([] (const TaskRef& task) { return task.done; }) == texts.size(), "archiveIf count");
+            }
+            else if (choice < 96)
+            {
+                model.collapsed = ! model.collapsed;
+                builder.setCollapsed (model.collapsed);
+            }
+            else if (choice < 97)
+            {
+                for (int i = model.tasks.size(); --i > 0;)
+                    model.tasks.swap (i, random.nextInt (i + 1));
+
+                for (int i = 0; i < 20; ++i)
+                    model.tasks.insert (random.nextInt (model.tasks.size() + 1), { randomText (random), false, TaskId::invalid, randomPosition (random) });
+
+                builder.setTasks (model.tasks);
+
+                for (int i = 0; i < model.tasks.size(); ++i)
+                {
+                    auto& task = model.tasks.getReference (i);
+                    const auto built = builder.getTask (i);
+
+                    if (task.id == TaskId::invalid && built)
+                    {
+                        checker.check (usedIds.insert (built->id).second, "setTasks new ID");
+                        task.id = built->id;
+                    }
+                }
+            }
+            else if (size > 0)
+            {
+                const auto index = random.nextInt (size);
+                checker.check (builder.indexOf (model.tasks.getReference (index).id) == index, "builder indexOf");
+                checker.check (builder.getTask (index) && builder.getTask (index)->id == model.tasks.getReference (index).id, "builder getTask");
+            }
+        }
+
+        checker.check (builder.size() == model.tasks.size(), "builder size");
+        snapshot = builder.build();
+
+        checkSnapshot (checker, snapshot, model, random, snapshot.getArchive() != previousSnapshot.getArchive());
+        checkIdIndex (checker, idIndex, snapshot, model, removedIds, random);
+
+        // Snapshots are persistent: the previous one must not have seen any of these edits.
+        checker.context << ", previous snapshot";
+        checkSnapshot (checker, previousSnapshot, previousModel, random, false);
+        checker.check (idIndex.indexOf (previousSnapshot, TaskId::invalid) == -1, "stale index");
+
+        for (int i = 0; i < juce::jmin (20, previousModel.tasks.size()); ++i)
+        {
+            const auto index = random.nextInt (previousModel.tasks.size());
+            checker.check (idIndex.indexOf (previousSnapshot, previousModel.tasks.getReference (index).id) == index, "stale indexOf");
+        }
+
+        previousSnapshot = snapshot;
+        previousModel = model;
+    }
+}
+
+void checkProcessorMatches (Checker& checker, const TodoListNativeAudioProcessor& processor, const Model& model, double tolerance)
+{
+    checker.check (processor.getNumTasks() == model.tasks.size(), "processor size " + juce::String (processor.getNumTasks()));
+    checker.check (processor.getCollapsed() == model.collapsed, "processor collapsed");
+
+    for (int i = 0; i < juce::jmin (processor.getNumTasks(), model.tasks.size()); ++i)
+    {
+        const auto task = processor.getTask (i);
+        const auto& expected = model.tasks.getReference (i);
+        checker.check (task.text == expected.text && task.done == expected.done, "processor task " + juce::String (i));
+        checker.check (samePosition (task.position, expected.position, tolerance), "processor position " + juce::String (i));
+    }
+
+    const auto archive = processor.getArchive();
+    checker.check (archive != nullptr && archive->loadTasks() == model.archived, "processor archive");
+    checker.check (processor.getStats().archived == model.archived.size(), "processor stats archived");
+}
+
+// Saves a random list in each format, loads it into a fresh processor and saves it again.
+void checkRoundTrips (Checker& checker, juce::int64 seed)
+{
+    juce::Random random (seed);
+    TodoListNativeAudioProcessor source;
+    source.setArchiveThreshold (0);
+    Model model;
+
+    for (int round = 0; round < 4; ++round)
+    {
+        source.applyBatch ([&] (TodoListNativeAudioProcessor::Batch& batch)
+        {
+            for (int i = 0; i < 500; ++i)
+            {
+                const auto text = randomText (random);
+                const auto position = randomPosition (random);
+                batch.addTask (text, position);
+                model.tasks.add ({ text, false, TaskId::invalid, position });
+            }
+
+            for (int i = 0; i < model.tasks.size(); ++i)
+            {
+                if (random.nextInt (3) == 0)
+                {
+                    batch.setTaskDone (i, true);
+                    model.tasks.getReference (i).done = true;
+                }
+            }
+        });
+
+        source.archiveDoneTasks();
+
+        juce::StringArray archivedNow;
+
+        for (int i = model.tasks.size(); --i >= 0;)
+        {
+            if (model.tasks.getReference (i).done && ! model.tasks.getReference (i).position)
+            {
+                archivedNow.insert (0, model.tasks.getReference (i).text);
+                model.tasks.remove (i);
+            }
+        }
+
+        model.archived.addArray (archivedNow);
+    }
+
+    model.collapsed = true;
+    source.setCollapsed (true);
+
+    checker.context = "seed " + juce::String (seed) + ", source";
+    checkProcessorMatches (checker, source, model, 0.0);
+
+    for (auto format : { TodoListNativeAudioProcessor::StateFormat::binary, TodoListNativeAudioProcessor::StateFormat::json })
+    {
+        const auto isJson = format == TodoListNativeAudioProcessor::StateFormat::json;
+        checker.context = "seed " + juce::String (seed) + (isJson ? ", json" : ", binary");
+
+        source.setStateFormat (format);
+        juce::MemoryBlock saved;
+        source.getStateInformation (saved);
+
+        TodoListNativeAudioProcessor loaded;
+        loaded.setAsyncStateLoading (false);
+        loaded.setStateInformation (saved.getData(), (int) saved.getSize());
+        checkProcessorMatches (checker, loaded, model, isJson ? 1.0e-6 : 0.0);
+        checker.check (loaded.getStateFormat() == format, "loaded format");
+
+        // An edit makes the next save serialize the tree rather than hand back the loaded bytes.
+        loaded.addTask ("x");
+        loaded.removeTask (loaded.getNumTasks() - 1);
+
+        juce::MemoryBlock resaved;
+        loaded.getStateInformation (resaved);
+        checker.check (resaved == saved, "resaved state differs");
+    }
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const juce::ArgumentList args (argc, argv);
+    const auto getOption = [&args] (const juce::String& option, int defaultValue)
+    {
+        const auto value = args.getValueForOption (option);
+        return value.isNotEmpty() ? value.getIntValue() : defaultValue;
+    };
+
+    const auto firstSeed = getOption ("--seed", 1);
+    const auto numSeeds = juce::jmax (1, getOption ("--seeds", 4));
+    const auto numRounds = juce::jmax (1, getOption ("--rounds", 300));
+
+    Checker checker;
+
+    for (auto seed = firstSeed; seed < firstSeed + numSeeds; ++seed)
+    {
+        std::cerr << "seed " << seed << std::endl;
+        checkTree (checker, seed, numRounds);
+        checkRoundTrips (checker, seed);
+    }
+
+    std::cout << (checker.numFailures == 0 ? "passed" : juce::String (checker.numFailures) + " checks failed") << std::endl;
+    return checker.numFailures == 0 ? 0 : 1;
+}
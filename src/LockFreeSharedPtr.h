@@ -0,0 +1,74 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Readers never lock or wait. Stores must be serialised by the caller.
+template <typename ObjectType>
+class LockFreeSharedPtr
+{
+public:
+    using Ptr = std::shared_ptr<ObjectType>;
+
+    LockFreeSharedPtr() = default;
+
+    explicit LockFreeSharedPtr (Ptr initial)
+    {
+        slots[0].object = std::move (initial);
+    }
+
+    Ptr load() const noexcept
+    {
+        for (;;)
+        {
+            const auto index = published.load();
+            auto& slot = slots[index];
+            ++slot.numReaders;
+
+            if (published.load() == index)
+            {
+                auto object = slot.object;
+                --slot.numReaders;
+                return object;
+            }
+
+            --slot.numReaders;
+        }
+    }
+
+    void store (Ptr newObject) noexcept
+    {
+        const auto current = published.load();
+        auto index = current;
+
+        // A slot can only be busy with a reader that's about to notice it isn't published
+        // any more, so one comes free within a few tries.
+        for (size_t i = 1;; ++i)
+        {
+            index = (current + i) % numSlots;
+
+            if (index != current && slots[index].numReaders.load() == 0)
+                break;
+        }
+
+        slots[index].object = std::move (newObject);
+        published.store (index);
+
+        for (size_t i = 0; i < numSlots; ++i)
+            if (i != index && slots[i].numReaders.load() == 0)
+                slots[i].object.reset();
+    }
+
+private:
+    static constexpr size_t numSlots = 4;
+
+    struct Slot
+    {
+        Ptr object;
+        mutable std::atomic<int> numReaders { 0 };
+    };
+
+    std::array<Slot, numSlots> slots;
+    std::atomic<size_t> published { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (LockFreeSharedPtr)
+};
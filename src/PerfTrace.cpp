@@ -0,0 +1,351 @@
+#include "PerfTrace.h"
+
+namespace
+{
+constexpr size_t kSamplesPerThread = 8192;
+constexpr int kMaxThreads = 64;
+constexpr int kSpareBuffers = 4;
+
+// Only the owning thread writes a buffer. A reader copying it throws away any slot the
+// writer may have reached in the meantime.
+struct ThreadBuffer
+{
+    struct Slot
+    {
+        std::atomic<const char*> name { nullptr };
+        std::atomic<juce::int64> startTicks { 0 }, endTicks { 0 };
+        std::atomic<int> threadIndex { 0 };
+    };
+
+    std::array<Slot, kSamplesPerThread> slots;
+    std::atomic<juce::uint64> numWritten { 0 };
+    std::atomic<juce::Thread::ThreadID> owner { nullptr };
+    std::atomic<int> threadIndex { 0 };
+};
+
+// Buffers are made ahead of time, off the recording threads, so the audio thread only has
+// to claim one. Threads find theirs by ID, as a thread_local can allocate on first use.
+struct Registry
+{
+    juce::CriticalSection lock;
+    std::array<std::atomic<ThreadBuffer*>, kMaxThreads> buffers {};
+    std::atomic<int> numBuffers { 0 }, numThreadsSeen { 0 }, messageThreadIndex { 0 };
+    std::array<std::atomic<juce::Thread::ThreadID>, kMaxThreads> unrecorded {};
+    std::vector<std::unique_ptr<ThreadBuffer>> owned;
+
+    void reserveSpareBuffers()
+    {
+        const juce::ScopedLock sl (lock);
+        auto numSpare = 0;
+
+        for (const auto& buffer : owned)
+            if (buffer->owner.load() == nullptr)
+                ++numSpare;
+
+        for (; numSpare < kSpareBuffers && (int) owned.size() < kMaxThreads; ++numSpare)
+        {
+            owned.push_back (std::make_unique<ThreadBuffer>());
+            buffers[owned.size() - 1].store (owned.back().get(), std::memory_order_release);
+            numBuffers.store ((int) owned.size(), std::memory_order_release);
+        }
+    }
+
+    template <typename Function>
+    void forEachBuffer (Function&& function) const
+    {
+        const auto num = numBuffers.load (std::memory_order_acquire);
+        for (int i = 0; i < num; ++i)
+            function (*buffers[(size_t) i].load (std::memory_order_acquire));
+    }
+};
+
+Registry& getRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+struct ReleaseOnThreadExit
+{
+    std::atomic<juce::Thread::ThreadID>* held = nullptr;
+
+    ~ReleaseOnThreadExit()
+    {
+        if (held != nullptr)
+            held->store (nullptr);
+    }
+};
+
+// Real-time threads never get here, as this uses a thread_local.
+void releaseOnThreadExit (std::atomic<juce::Thread::ThreadID>& held)
+{
+    thread_local ReleaseOnThreadExit release;
+    release.held = &held;
+}
+
+ThreadBuffer* findBuffer (juce::Thread::ThreadID thread)
+{
+    ThreadBuffer* found = nullptr;
+
+    getRegistry().forEachBuffer ([&found, thread] (ThreadBuffer& buffer)
+    {
+        if (found == nullptr && buffer.owner.load (std::memory_order_relaxed) == thread)
+            found = &buffer;
+    });
+
+    return found;
+}
+
+std::atomic<juce::Thread::ThreadID>* findUnrecorded (juce::Thread::ThreadID thread)
+{
+    for (auto& entry : getRegistry().unrecorded)
+        if (entry.load (std::memory_order_relaxed) == thread)
+            return &entry;
+
+    return nullptr;
+}
+
+void noteUnrecorded (juce::Thread::ThreadID thread, bool isRealtime)
+{
+    if (findUnrecorded (thread) != nullptr)
+        return;
+
+    for (auto& entry : getRegistry().unrecorded)
+    {
+        juce::Thread::ThreadID expected = nullptr;
+
+        if (entry.compare_exchange_strong (expected, thread))
+        {
+            if (! isRealtime)
+                releaseOnThreadExit (entry);
+
+            return;
+        }
+    }
+}
+
+ThreadBuffer* claimBuffer (juce::Thread::ThreadID thread, bool isRealtime)
+{
+    auto& registry = getRegistry();
+    ThreadBuffer* claimed = nullptr;
+
+    registry.forEachBuffer ([&claimed, thread] (ThreadBuffer& buffer)
+    {
+        juce::Thread::ThreadID expected = nullptr;
+        if (claimed == nullptr && buffer.owner.compare_exchange_strong (expected, thread))
+            claimed = &buffer;
+    });
+
+    if (claimed == nullptr)
+    {
+        noteUnrecorded (thread, isRealtime);
+        return nullptr;
+    }
+
+    const auto threadIndex = ++registry.numThreadsSeen;
+    claimed->threadIndex.store (threadIndex, std::memory_order_relaxed);
+
+    if (juce::MessageManager::existsAndIsCurrentThread())
+        registry.messageThreadIndex = threadIndex;
+
+    if (auto* entry = findUnrecorded (thread))
+        entry->store (nullptr);
+
+    if (! isRealtime)
+        releaseOnThreadExit (claimed->owner);
+
+    return claimed;
+}
+
+ThreadBuffer* getThreadBuffer (bool isRealtimeThread)
+{
+    const auto thread = juce::Thread::getCurrentThreadId();
+
+    if (auto* buffer = findBuffer (thread))
+        return buffer;
+
+    return claimBuffer (thread, isRealtimeThread);
+}
+
+double ticksToMilliseconds (juce::int64 ticks)
+{
+    return juce::Time::highResolutionTicksToSeconds (ticks) * 1000.0;
+}
+} // namespace
+
+void PerfTrace::setEnabled (bool shouldBeEnabled)
+{
+    if (shouldBeEnabled)
+        getRegistry().reserveSpareBuffers();
+
+    enabled.store (shouldBeEnabled, std::memory_order_relaxed);
+}
+
+void PerfTrace::record (const char* name, juce::int64 startTicks, juce::int64 endTicks, bool isRealtimeThread) noexcept
+{
+    auto* buffer = getThreadBuffer (isRealtimeThread);
+    if (buffer == nullptr)
+        return;
+
+    const auto index = buffer->numWritten.load (std::memory_order_relaxed);
+    auto& slot = buffer->slots[index % kSamplesPerThread];
+
+    slot.name.store (name, std::memory_order_relaxed);
+    slot.startTicks.store (startTicks, std::memory_order_relaxed);
+    slot.endTicks.store (endTicks, std::memory_order_relaxed);
+    slot.threadIndex.store (buffer->threadIndex.load (std::memory_order_relaxed), std::memory_order_relaxed);
+    buffer->numWritten.store (index + 1, std::memory_order_release);
+}
+
+int PerfTrace::getNumUnrecordedThreads() noexcept
+{
+    auto num = 0;
+
+    for (const auto& entry : getRegistry().unrecorded)
+        if (entry.load (std::memory_order_relaxed) != nullptr)
+            ++num;
+
+    return num;
+}
+
+std::vector<PerfTrace::Sample> PerfTrace::collectSamples()
+{
+    std::vector<Sample> samples;
+    auto& registry = getRegistry();
+
+    registry.reserveSpareBuffers();
+
+    registry.forEachBuffer ([&samples] (const ThreadBuffer& buffer)
+    {
+        const auto numWritten = buffer.numWritten.load (std::memory_order_acquire);
+        const auto first = numWritten > kSamplesPerThread ? numWritten - kSamplesPerThread : 0;
+        const auto numBefore = samples.size();
+
+        for (auto i = first; i < numWritten; ++i)
+        {
+            const auto& slot = buffer.slots[i % kSamplesPerThread];
+            samples.push_back ({ slot.name.load (std::memory_order_relaxed),
+                                 slot.startTicks.load (std::memory_order_relaxed),
+                                 slot.endTicks.load (std::memory_order_relaxed),
+                                 slot.threadIndex.load (std::memory_order_relaxed) });
+        }
+
+        // The writer may have lapped the oldest slots while they were being copied.
+        std::atomic_thread_fence (std::memory_order_acquire);
+        const auto numWrittenAfter = buffer.numWritten.load (std::memory_order_relaxed);
+        const auto firstIntact = numWrittenAfter >= kSamplesPerThread ? numWrittenAfter - kSamplesPerThread + 1 : 0;
+
+        if (firstIntact > first)
+        {
+            const auto numOverwritten = (size_t) juce::jmin (firstIntact - first, numWritten - first);
+            samples.erase (samples.begin() + (std::ptrdiff_t) numBefore,
+                           samples.begin() + (std::ptrdiff_t) (numBefore + numOverwritten));
+        }
+    });
+
+    return samples;
+}
+
+std::vector<PerfTrace::Summary> PerfTrace::summarise (double lastSeconds)
+{
+    const auto now = juce::Time::getHighResolutionTicks();
+    const auto since = now - (juce::int64) (lastSeconds * (double) juce::Time::getHighResolutionTicksPerSecond());
+
+    struct Totals
+    {
+        int count = 0;
+        juce::int64 totalTicks = 0, maxTicks = 0;
+    };
+
+    std::map<const char*, Totals> totalsByName;
+
+    for (const auto& sample : collectSamples())
+    {
+        if (sample.name == nullptr || sample.endTicks < since)
+            continue;
+
+        auto& totals = totalsByName[sample.name];
+        const auto ticks = sample.endTicks - sample.startTicks;
+        ++totals.count;
+        totals.totalTicks += ticks;
+        totals.maxTicks = juce::jmax (totals.maxTicks, ticks);
+    }
+
+    std::vector<std::pair<juce::int64, Summary>> sorted;
+
+    for (const auto& [name, totals] : totalsByName)
+        sorted.push_back ({ totals.totalTicks, { name, totals.count,
+                                                 ticksToMilliseconds (totals.totalTicks) / totals.count,
+                                                 ticksToMilliseconds (totals.maxTicks) } });
+
+    std::sort (sorted.begin(), sorted.end(), [] (const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::vector<Summary> summaries;
+    for (const auto& entry : sorted)
+        summaries.push_back (entry.second);
+
+    return summaries;
+}
+
+bool PerfTrace::writeChromeTrace (const juce::File& file)
+{
+    const auto samples = collectSamples();
+
+    juce::FileOutputStream out (file);
+    if (! out.openedOk())
+        return false;
+
+    out.setPosition (0);
+    out.truncate();
+
+    const auto origin = samples.empty() ? 0 : std::min_element (samples.begin(), samples.end(), [] (const auto& a, const auto& b)
+    {
+        return a.startTicks < b.startTicks;
+    })->startTicks;
+
+    const auto toMicroseconds = [] (juce::int64 ticks) { return juce::Time::highResolutionTicksToSeconds (ticks) * 1.0e6; };
+    const char* separator = "\n";
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    if (const auto numUnrecorded = getNumUnrecordedThreads(); numUnrecorded > 0)
+    {
+        out << separator << "{\"name\":\"process_labels\",\"ph\":\"M\",\"pid\":1,\"args\":{\"labels\":"
+            << juce::JSON::toString (juce::String (numUnrecorded) + " threads unrecorded") << "}}";
+        separator = ",\n";
+    }
+
+    std::vector<int> threadIndices;
+    for (const auto& sample : samples)
+        threadIndices.push_back (sample.threadIndex);
+
+    std::sort (threadIndices.begin(), threadIndices.end());
+    threadIndices.erase (std::unique (threadIndices.begin(), threadIndices.end()), threadIndices.end());
+
+    const auto messageThreadIndex = getRegistry().messageThreadIndex.load();
+
+    for (const auto threadIndex : threadIndices)
+    {
+        const auto threadName = threadIndex == messageThreadIndex ? juce::String ("message thread")
+                                                                  : "thread " + juce::String (threadIndex);
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadIndex
+            << ",\"args\":{\"name\":" << juce::JSON::toString (threadName) << "}}";
+        separator = ",\n";
+    }
+
+    for (const auto& sample : samples)
+    {
+        if (sample.name == nullptr)
+            continue;
+
+        out << separator << "{\"name\":" << juce::JSON::toString (juce::String (sample.name))
+            << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << sample.threadIndex
+            << ",\"ts\":" << juce::String (toMicroseconds (sample.startTicks - origin), 3)
+            << ",\"dur\":" << juce::String (toMicroseconds (sample.endTicks - sample.startTicks), 3) << "}";
+        separator = ",\n";
+    }
+
+    out << "\n]}\n";
+    out.flush();
+    return out.getStatus().wasOk();
+}
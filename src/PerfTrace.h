@@ -0,0 +1,101 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "RealtimeGuard.h"
+
+#ifndef TODOLIST_PERF_TRACE
+ #define TODOLIST_PERF_TRACE 1
+#endif
+
+class PerfTrace
+{
+public:
+    struct Sample
+    {
+        const char* name = nullptr;
+        juce::int64 startTicks = 0, endTicks = 0;
+        int threadIndex = 0;
+    };
+
+    struct Summary
+    {
+        const char* name = nullptr;
+        int count = 0;
+        double meanMs = 0.0, maxMs = 0.0;
+    };
+
+    static void setEnabled (bool shouldBeEnabled);
+    static bool isEnabled() noexcept            { return enabled.load (std::memory_order_relaxed); }
+
+    // Safe on the audio thread: finds its buffer by thread ID and never allocates or locks.
+    // The name must outlive the trace.
+    static void record (const char* name, juce::int64 startTicks, juce::int64 endTicks, bool isRealtimeThread = false) noexcept;
+
+    static int getNumUnrecordedThreads() noexcept;
+    static std::vector<Sample> collectSamples();
+    static std::vector<Summary> summarise (double lastSeconds);
+    static bool writeChromeTrace (const juce::File& file);
+
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer (const char* scopeName, bool isRealtimeThread = false) noexcept
+            : name (isEnabled() ? scopeName : nullptr),
+              startTicks (name != nullptr ? juce::Time::getHighResolutionTicks() : 0),
+              realtime (isRealtimeThread)
+        {
+        }
+
+        ~ScopedTimer()
+        {
+            if (name != nullptr)
+                record (name, startTicks, juce::Time::getHighResolutionTicks(), realtime);
+        }
+
+    private:
+        const char* name;
+        juce::int64 startTicks;
+        bool realtime;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedTimer)
+    };
+
+    class TimedScopedLock
+    {
+    public:
+        TimedScopedLock (const juce::CriticalSection& lockToHold, const char* scopeName) noexcept
+            : lock (lockToHold)
+        {
+           #if TODOLIST_REALTIME_GUARD
+            RealtimeGuard::check (RealtimeGuard::Violation::lock, scopeName);
+           #endif
+
+           #if TODOLIST_PERF_TRACE
+            const ScopedTimer timer (scopeName);
+           #else
+            juce::ignoreUnused (scopeName);
+           #endif
+            lock.enter();
+        }
+
+        ~TimedScopedLock()      { lock.exit(); }
+
+    private:
+        const juce::CriticalSection& lock;
+
+        JUCE_DECLARE_NON_COPYABLE (TimedScopedLock)
+    };
+
+private:
+    static inline std::atomic<bool> enabled { false };
+
+    PerfTrace() = delete;
+};
+
+#if TODOLIST_PERF_TRACE
+ #define TODOLIST_TRACE_SCOPE(name) const PerfTrace::ScopedTimer JUCE_JOIN_MACRO (perfTraceScope_, __LINE__) (name)
+ #define TODOLIST_TRACE_REALTIME_SCOPE(name) const PerfTrace::ScopedTimer JUCE_JOIN_MACRO (perfTraceScope_, __LINE__) (name, true)
+#else
+ #define TODOLIST_TRACE_SCOPE(name)
+ #define TODOLIST_TRACE_REALTIME_SCOPE(name)
+#endif
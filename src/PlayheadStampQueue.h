@@ -0,0 +1,43 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "TaskSnapshot.h"
+
+// Single producer (audio thread), single consumer (message thread).
+class PlayheadStampQueue
+{
+public:
+    struct Stamp
+    {
+        juce::uint32 request = 0;
+        TaskPosition position;
+    };
+
+    bool push (const Stamp& stamp) noexcept
+    {
+        const auto scope = fifo.write (1);
+        if (scope.blockSize1 + scope.blockSize2 == 0)
+            return false;
+
+        stamps[(size_t) (scope.blockSize1 > 0 ? scope.startIndex1 : scope.startIndex2)] = stamp;
+        return true;
+    }
+
+    bool pop (Stamp& dest) noexcept
+    {
+        const auto scope = fifo.read (1);
+        if (scope.blockSize1 + scope.blockSize2 == 0)
+            return false;
+
+        dest = stamps[(size_t) (scope.blockSize1 > 0 ? scope.startIndex1 : scope.startIndex2)];
+        return true;
+    }
+
+private:
+    static constexpr int capacity = 64;
+
+    static_assert (std::is_trivially_copyable_v<Stamp>, "Copying a stamp mustn't allocate");
+
+    juce::AbstractFifo fifo { capacity };
+    std::array<Stamp, capacity> stamps;
+};
@@ -1,4 +1,5 @@
 #include "PluginEditor.h"
+#include "PerfTrace.h"
 
 namespace
 {
@@ -9,11 +10,148 @@ const auto kText = juce::Colour::fromRGB (230, 233, 238);
 const auto kMuted = juce::Colour::fromRGB (145, 151, 162);
 const auto kAccent = juce::Colour::fromRGB (87, 176, 235);
 const auto kDanger = juce::Colour::fromRGB (179, 84, 98);
+constexpr size_t kMaxCachedRows = 1024;
+constexpr float kSpritePadding = 1.0f;
+
+juce::String formatPosition (const TaskPosition& position)
+{
+    if (position.bar)
+        return "bar " + juce::String (*position.bar + 1);
+
+    if (position.timeInSeconds)
+    {
+        const auto tenths = juce::jmax ((juce::int64) 0, (juce::int64) std::llround (*position.timeInSeconds * 10.0));
+        return juce::String (tenths / 600) + ":" + juce::String ((tenths / 10) % 60).paddedLeft ('0', 2)
+               + "." + juce::String (tenths % 10);
+    }
+
+    if (position.ppq)
+        return "beat " + juce::String (*position.ppq + 1.0, 1);
+
+    return {};
+}
+
+template <typename DrawFunction>
+juce::Image renderSprite (juce::Rectangle<float> bounds, float scale, DrawFunction&& draw)
+{
+    const auto area = bounds.withZeroOrigin().expanded (kSpritePadding);
+    juce::Image sprite (juce::Image::ARGB,
+                        juce::roundToInt (std::ceil (area.getWidth() * scale)),
+                        juce::roundToInt (std::ceil (area.getHeight() * scale)),
+                        true);
+    juce::Graphics g (sprite);
+    g.addTransform (juce::AffineTransform::scale (scale).translated (kSpritePadding * scale, kSpritePadding * scale));
+    draw (g, bounds.withZeroOrigin());
+    return sprite;
+}
+
+class ArchiveViewer final : public juce::Component
+{
+public:
+    explicit ArchiveViewer (const TaskArchive& archive)
+    {
+        addAndMakeVisible (list);
+        list.setMultiLine (true);
+        list.setReadOnly (true);
+        list.setScrollbarsShown (true);
+        list.setColour (juce::TextEditor::backgroundColourId, kPanel.darker (0.2f));
+        list.setColour (juce::TextEditor::textColourId, kMuted);
+        list.setColour (juce::TextEditor::outlineColourId, kBorder);
+
+        const auto texts = archive.loadTasks();
+        list.setText (texts.isEmpty() ? juce::String ("nothing archived yet") : texts.joinIntoString ("\n"), false);
+        setSize (360, 240);
+    }
+
+    void resized() override
+    {
+        list.setBounds (getLocalBounds());
+    }
+
+private:
+    juce::TextEditor list;
+};
 } // namespace
 
+class PerfTraceOverlay final : public juce::Component,
+                               private juce::Timer
+{
+public:
+    PerfTraceOverlay()
+    {
+        setInterceptsMouseClicks (false, false);
+        PerfTrace::setEnabled (true);
+        startTimerHz (4);
+    }
+
+    ~PerfTraceOverlay() override
+    {
+        PerfTrace::setEnabled (false);
+    }
+
+    void setStatus (const juce::String& newStatus)
+    {
+        status = newStatus;
+        repaint();
+    }
+
+    void paint (juce::Graphics& g) override
+    {
+        g.setColour (kBg.withAlpha (0.88f));
+        g.fillRoundedRectangle (getLocalBounds().toFloat(), 6.0f);
+        g.setColour (kBorder);
+        g.drawRoundedRectangle (getLocalBounds().toFloat().reduced (0.5f), 6.0f, 1.0f);
+
+        g.setFont (juce::Font (juce::FontOptions (11.0f)));
+        auto area = getLocalBounds().reduced (8, 6);
+        const auto drawLine = [&] (const juce::String& name, const juce::String& count, const juce::String& mean, const juce::String& max, juce::Colour colour)
+        {
+            auto line = area.removeFromTop (15);
+            g.setColour (colour);
+            g.drawText (max, line.removeFromRight (60), juce::Justification::centredRight);
+            g.drawText (mean, line.removeFromRight (60), juce::Justification::centredRight);
+            g.drawText (count, line.removeFromRight (40), juce::Justification::centredRight);
+            g.drawText (name, line, juce::Justification::centredLeft, true);
+        };
+
+        drawLine ("last 2 s", "n", "mean ms", "max ms", kMuted);
+
+        for (const auto& summary : summaries)
+        {
+            if (area.getHeight() < 30)
+                break;
+
+            drawLine (summary.name, juce::String (summary.count), juce::String (summary.meanMs, 3), juce::String (summary.maxMs, 3), kText);
+        }
+
+        g.setColour (kMuted);
+        g.drawText (status.isNotEmpty() ? status : juce::String ("cmd+shift+T saves a Chrome trace"),
+                    area.removeFromBottom (15), juce::Justification::centredLeft, true);
+
+        if (numUnrecorded > 0)
+        {
+            g.setColour (kAccent);
+            g.drawText (juce::String (numUnrecorded) + " threads unrecorded, all buffers taken",
+                        area.removeFromBottom (15), juce::Justification::centredLeft, true);
+        }
+    }
+
+private:
+    std::vector<PerfTrace::Summary> summaries;
+    juce::String status;
+    int numUnrecorded = 0;
+
+    void timerCallback() override
+    {
+        summaries = PerfTrace::summarise (2.0);
+        numUnrecorded = PerfTrace::getNumUnrecordedThreads();
+        repaint();
+    }
+};
+
 class DetachedTodoComponent final : public juce::Component,
                                     private juce::Button::Listener,
-                                    private juce::Timer
+                                    private TodoListNativeAudioProcessor::Listener
 {
 public:
     explicit DetachedTodoComponent (TodoListNativeAudioProcessor& p)
@@ -29,6 +167,7 @@ public:
         input.setColour (juce::TextEditor::backgroundColourId, kPanel.darker (0.2f));
         input.setColour (juce::TextEditor::textColourId, kText);
         input.setColour (juce::TextEditor::outlineColourId, kBorder);
+        taskList.takeUndoKeysFrom (input);
 
         addAndMakeVisible (addButton);
         addButton.setColour (juce::TextButton::buttonColourId, kAccent.darker (0.25f));
@@ -43,7 +182,13 @@ public:
 
         setSize (430, 330);
         updateCollapsedUi();
-        startTimerHz (12);
+        updateStats();
+        processor.addListener (this);
+    }
+
+    ~DetachedTodoComponent() override
+    {
+        processor.removeListener (this);
     }
 
     void paint (juce::Graphics& g) override
@@ -82,8 +227,6 @@ private:
     juce::TextButton collapseButton { "Collapse" };
     juce::Label stats;
 
-    int lastTaskCount = -1;
-    int lastDoneCount = -1;
     bool isCollapsed = false;
 
     void buttonClicked (juce::Button* button) override
@@ -107,25 +250,16 @@ private:
         input.clear();
     }
 
-    void timerCallback() override
+    void tasksChanged (const TaskChangeSet&) override
     {
-        const auto total = processor.getNumTasks();
-        int done = 0;
-        for (int i = 0; i < total; ++i)
-            if (processor.getTask (i).done)
-                ++done;
-
-        if (total != lastTaskCount || done != lastDoneCount)
-        {
-            lastTaskCount = total;
-            lastDoneCount = done;
-            stats.setText (juce::String (total - done) + " active | " + juce::String (done) + " done",
-                           juce::dontSendNotification);
-            taskList.refreshSize();
-            resized();
-            repaint();
-        }
+        updateStats();
+    }
 
+    void updateStats()
+    {
+        const auto taskStats = processor.getStats();
+        stats.setText (juce::String (taskStats.active) + " active | " + juce::String (taskStats.done) + " done",
+                       juce::dontSendNotification);
     }
 
     void updateCollapsedUi()
@@ -155,15 +289,28 @@ private:
 TaskListComponent::TaskListComponent (TodoListNativeAudioProcessor& processorRef)
     : processor (processorRef)
 {
+    setWantsKeyboardFocus (true);
+    processor.addListener (this);
     refreshSize();
 }
 
+TaskListComponent::~TaskListComponent()
+{
+    processor.removeListener (this);
+}
+
 void TaskListComponent::paint (juce::Graphics& g)
 {
+    TODOLIST_TRACE_SCOPE ("TaskListComponent::paint");
+
     g.fillAll (kBg.darker (0.08f));
-    const auto num = processor.getNumTasks();
+    const auto snapshot = processor.getSnapshot();
+    const auto visibleRows = getRowsIntersecting (g.getClipBounds());
 
-    for (int i = 0; i < num; ++i)
+    updateSprites (g.getInternalContext().getPhysicalPixelScaleFactor());
+    ++paintCount;
+
+    const auto paintRow = [&] (int i, const TaskRef& task)
     {
         const auto row = juce::Rectangle<float> (0.0f, (float) (i * rowHeight), (float) getWidth(), (float) rowHeight);
         const bool isDragRow = (dragging && i == dragFrom);
@@ -179,42 +326,58 @@ void TaskListComponent::paint (juce::Graphics& g)
             g.fillRect (juce::Rectangle<float> (8.0f, row.getY() + 1.0f, (float) getWidth() - 16.0f, 2.0f));
         }
 
-        const auto task = processor.getTask (i);
-        auto cb = getCheckboxBounds (i);
-        auto del = getDeleteBounds (i);
+        const auto& cached = getCachedRow (task);
+        const auto textArea = getTextArea (i, task.position != nullptr);
 
-        g.setColour (kBorder);
-        g.drawRoundedRectangle (cb, 3.0f, 1.0f);
-        if (task.done)
-        {
-            g.setColour (kAccent);
-            juce::Path check;
-            check.startNewSubPath (cb.getX() + 3.0f, cb.getCentreY());
-            check.lineTo (cb.getX() + 7.0f, cb.getBottom() - 4.0f);
-            check.lineTo (cb.getRight() - 3.0f, cb.getY() + 3.0f);
-            g.strokePath (check, juce::PathStrokeType (2.0f));
-        }
+        g.drawImage (task.done ? sprites.checkedBox : sprites.checkbox, getCheckboxBounds (i).expanded (kSpritePadding));
 
-        auto textArea = row.reduced (36.0f, 0.0f).withTrimmedRight (34.0f);
-        g.setFont (14.0f);
         g.setColour (task.done ? kMuted : kText);
-        g.drawFittedText (task.text, textArea.toNearestInt(), juce::Justification::centredLeft, 1);
+        cached.glyphs.draw (g, juce::AffineTransform::translation (0.0f, row.getY()));
         if (task.done)
         {
-            const float renderedTextWidth = juce::jmin ((float) textArea.getWidth(),
-                                                        (float) g.getCurrentFont().getStringWidth (task.text));
             g.setColour (kMuted);
             g.drawLine ((float) textArea.getX(),
                         row.getCentreY(),
-                        (float) textArea.getX() + renderedTextWidth,
+                        (float) textArea.getX() + cached.textWidth,
                         row.getCentreY(),
                         1.2f);
         }
 
-        g.setColour (kDanger);
-        g.drawRoundedRectangle (del, 4.0f, 1.0f);
-        g.drawLine (del.getX() + 5.0f, del.getY() + 5.0f, del.getRight() - 5.0f, del.getBottom() - 5.0f, 1.2f);
-        g.drawLine (del.getRight() - 5.0f, del.getY() + 5.0f, del.getX() + 5.0f, del.getBottom() - 5.0f, 1.2f);
+        if (task.position != nullptr)
+        {
+            g.setColour (kAccent);
+            g.setFont (juce::Font (juce::FontOptions (11.0f)));
+            g.drawText (formatPosition (*task.position), getPositionBounds (i), juce::Justification::centredRight, false);
+        }
+
+        g.drawImage (sprites.deleteButton, getDeleteBounds (i).expanded (kSpritePadding));
+    };
+
+    if (filter.isEmpty())
+    {
+        snapshot.visitTasks (visibleRows.getStart(), visibleRows.getEnd(), paintRow);
+    }
+    else
+    {
+        for (auto i = visibleRows.getStart(); i < juce::jmin (visibleRows.getEnd(), getNumRows()); ++i)
+            if (const auto task = getTaskInRow (snapshot, i))
+                paintRow (i, *task);
+    }
+
+    if (showRepaintRegions)
+    {
+        const auto area = g.getClipBounds();
+        const auto colour = juce::Colour::fromHSV ((float) (paintCount % 12) / 12.0f, 0.8f, 1.0f, 1.0f);
+        g.setColour (colour.withAlpha (0.15f));
+        g.fillRect (area);
+        g.setColour (colour);
+        g.drawRect (area, 1);
+    }
+
+    if (rowCache.size() > kMaxCachedRows)
+    {
+        for (auto it = rowCache.begin(); it != rowCache.end();)
+            it = it->second.lastPainted != paintCount ? rowCache.erase (it) : std::next (it);
     }
 }
 
@@ -223,18 +386,131 @@ void TaskListComponent::resized()
     refreshSize();
 }
 
+void TaskListComponent::tasksChanged (const TaskChangeSet& changes)
+{
+    if (filter.isNotEmpty())
+    {
+        filteredTasks = processor.findTasks (filter);
+        refreshSize();
+        repaint();
+        return;
+    }
+
+    if (changes.listReplaced)
+    {
+        refreshSize();
+        repaint();
+        return;
+    }
+
+    const auto numRows = juce::jmax (getNumRows(), getHeight() / rowHeight);
+
+    for (const auto& change : changes.changes)
+    {
+        switch (change.type)
+        {
+            case TaskChange::Type::inserted:
+            case TaskChange::Type::removed:
+                repaintRows ({ change.range.getStart(), numRows });
+                break;
+
+            case TaskChange::Type::moved:
+                repaintRows ({ juce::jmin (change.range.getStart(), change.destination),
+                               juce::jmax (change.range.getStart(), change.destination) + 1 });
+                break;
+
+            case TaskChange::Type::updated:
+                repaintRows (change.range);
+                break;
+        }
+    }
+
+    refreshSize();
+}
+
+void TaskListComponent::repaintRows (juce::Range<int> rows)
+{
+    if (! rows.isEmpty())
+        repaint (getRowBounds (rows));
+}
+
+void TaskListComponent::setFilter (const juce::String& newFilter)
+{
+    if (filter == newFilter)
+        return;
+
+    filter = newFilter;
+    filteredTasks = processor.findTasks (filter, &filteredTasks);
+    refreshSize();
+    repaint();
+}
+
+void TaskListComponent::showTask (TaskId id)
+{
+    auto row = -1;
+
+    if (filter.isEmpty())
+    {
+        row = processor.getTaskIndex (id);
+    }
+    else
+    {
+        const auto& ids = filteredTasks.ids;
+        const auto found = std::find (ids.begin(), ids.end(), id);
+        row = found != ids.end() ? (int) (found - ids.begin()) : -1;
+    }
+
+    auto* viewport = findParentComponentOfClass<juce::Viewport>();
+    if (row < 0 || viewport == nullptr)
+        return;
+
+    const auto centredY = row * rowHeight - (viewport->getViewHeight() - rowHeight) / 2;
+    viewport->setViewPosition (0, juce::jlimit (0, juce::jmax (0, getHeight() - viewport->getViewHeight()), centredY));
+}
+
+int TaskListComponent::getNumRows() const
+{
+    return filter.isEmpty() ? processor.getNumTasks() : (int) filteredTasks.size();
+}
+
+std::optional<TaskRef> TaskListComponent::getTaskInRow (const TaskSnapshot& snapshot, int row) const
+{
+    if (filter.isEmpty())
+        return snapshot.getTask (row);
+
+    if (! juce::isPositiveAndBelow (row, (int) filteredTasks.size()))
+        return {};
+
+    const auto id = filteredTasks.ids[(size_t) row];
+    const auto index = filteredTasks.indices[(size_t) row];
+
+    if (auto task = snapshot.getTask (index); task.has_value() && task->id == id)
+        return task;
+
+    // The task moved since the search; show it as found until the next search.
+    return filteredTasks.snapshot.getTask (index);
+}
+
+void TaskListComponent::setShowRepaintRegions (bool shouldShow)
+{
+    showRepaintRegions = shouldShow;
+    repaint();
+}
+
 void TaskListComponent::mouseDown (const juce::MouseEvent& event)
 {
-    pressed = hitAt (event.position);
+    grabKeyboardFocus();
+
+    pressed = hitAt (event.position, processor.getSnapshot());
     if (pressed.index < 0)
         return;
 
-    if (pressed.zone == HitZone::Row)
+    if (pressed.zone == HitZone::Row && filter.isEmpty())
     {
         dragFrom = pressed.index;
         dragOver = pressed.index;
         dragging = true;
-        repaint();
+        repaintRows ({ dragFrom, dragFrom + 1 });
     }
 }
 
@@ -243,47 +519,75 @@ void TaskListComponent::mouseDrag (const juce::MouseEvent& event)
     if (! dragging || dragFrom < 0)
         return;
 
-    auto hit = hitAt (event.position);
+    auto hit = hitAt (event.position, processor.getSnapshot());
     if (hit.index >= 0 && hit.index != dragOver)
     {
+        repaintRows ({ dragOver, dragOver + 1 });
         dragOver = hit.index;
-        repaint();
+        repaintRows ({ dragOver, dragOver + 1 });
     }
 }
 
 void TaskListComponent::mouseUp (const juce::MouseEvent& event)
 {
-    const auto released = hitAt (event.position);
+    const auto snapshot = processor.getSnapshot();
+    const auto released = hitAt (event.position, snapshot);
 
     if (dragging)
     {
         if (dragFrom >= 0 && dragOver >= 0 && dragOver != dragFrom)
-            processor.moveTask (dragFrom, dragOver);
+            processor.moveTask (pressed.id, dragOver);
     }
-    else if (pressed.index >= 0 && pressed.index == released.index)
+    else if (pressed.id != TaskId::invalid && pressed.id == released.id)
     {
         if (pressed.zone == HitZone::Checkbox)
         {
-            const auto task = processor.getTask (pressed.index);
-            processor.setTaskDone (pressed.index, ! task.done);
+            if (auto task = getTaskInRow (snapshot, released.index))
+                processor.setTaskDone (pressed.id, ! task->done);
         }
         else if (pressed.zone == HitZone::Delete)
         {
-            processor.removeTask (pressed.index);
+            processor.removeTask (pressed.id);
         }
     }
 
+    if (dragging)
+    {
+        repaintRows ({ dragFrom, dragFrom + 1 });
+        repaintRows ({ dragOver, dragOver + 1 });
+    }
+
     dragFrom = -1;
     dragOver = -1;
     dragging = false;
     pressed = {};
-    refreshSize();
-    repaint();
+}
+
+bool TaskListComponent::keyPressed (const juce::KeyPress& key)
+{
+    if (key == juce::KeyPress ('z', juce::ModifierKeys::commandModifier, 0))
+        return processor.undo();
+
+    if (key == juce::KeyPress ('z', juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier, 0))
+        return processor.redo();
+
+    return false;
+}
+
+bool TaskListComponent::keyPressed (const juce::KeyPress& key, juce::Component* origin)
+{
+    auto* textBox = dynamic_cast<juce::TextEditor*> (origin);
+    return textBox != nullptr && textBox->isEmpty() && keyPressed (key);
+}
+
+void TaskListComponent::takeUndoKeysFrom (juce::TextEditor& textBox)
+{
+    textBox.addKeyListener (this);
 }
 
 int TaskListComponent::getPreferredHeight() const
 {
-    return juce::jmax (120, processor.getNumTasks() * rowHeight + 8);
+    return juce::jmax (120, getNumRows() * rowHeight + 8);
 }
 
 void TaskListComponent::refreshSize()
@@ -291,17 +595,97 @@ void TaskListComponent::refreshSize()
     setSize (juce::jmax (200, getWidth()), getPreferredHeight());
 }
 
-TaskListComponent::HitInfo TaskListComponent::hitAt (juce::Point<float> p) const
+TaskListComponent::HitInfo TaskListComponent::hitAt (juce::Point<float> p, const TaskSnapshot& snapshot) const
 {
     const int index = (int) (p.y / (float) rowHeight);
-    if (! juce::isPositiveAndBelow (index, processor.getNumTasks()))
+    const auto task = getTaskInRow (snapshot, index);
+    if (! task.has_value())
         return {};
 
     if (getCheckboxBounds (index).contains (p))
-        return { index, HitZone::Checkbox };
+        return { index, task->id, HitZone::Checkbox };
     if (getDeleteBounds (index).contains (p))
-        return { index, HitZone::Delete };
-    return { index, HitZone::Row };
+        return { index, task->id, HitZone::Delete };
+    return { index, task->id, HitZone::Row };
+}
+
+juce::Rectangle<int> TaskListComponent::getRowBounds (juce::Range<int> rows) const
+{
+    return { 0, rows.getStart() * rowHeight, getWidth(), rows.getLength() * rowHeight };
+}
+
+juce::Range<int> TaskListComponent::getRowsIntersecting (juce::Rectangle<int> area) const
+{
+    const auto first = juce::jmax (0, area.getY() / rowHeight);
+    const auto last = juce::jmax (first, (area.getBottom() + rowHeight - 1) / rowHeight);
+    return { first, last };
+}
+
+juce::Rectangle<int> TaskListComponent::getTextArea (int row, bool hasPosition) const
+{
+    const auto rowArea = juce::Rectangle<float> (0.0f, (float) (row * rowHeight), (float) getWidth(), (float) rowHeight);
+    return rowArea.reduced (36.0f, 0.0f).withTrimmedRight (hasPosition ? 64.0f : 34.0f).toNearestInt();
+}
+
+// Glyphs are laid out for row 0 and translated.
+const TaskListComponent::CachedRow& TaskListComponent::getCachedRow (const TaskRef& task)
+{
+    auto& cached = rowCache[task.id];
+    cached.lastPainted = paintCount;
+
+    const auto hasPosition = task.position != nullptr;
+
+    if (cached.width == getWidth() && cached.hasPosition == hasPosition && cached.text == task.text)
+        return cached;
+
+    const auto textArea = getTextArea (0, hasPosition);
+    cached.text = task.text;
+    cached.width = getWidth();
+    cached.hasPosition = hasPosition;
+    cached.glyphs.clear();
+    cached.glyphs.addFittedText (juce::Font (juce::FontOptions (14.0f)), cached.text,
+                                 (float) textArea.getX(), (float) textArea.getY(),
+                                 (float) textArea.getWidth(), (float) textArea.getHeight(),
+                                 juce::Justification::centredLeft, 1);
+    cached.textWidth = juce::jmin ((float) textArea.getWidth(),
+                                   cached.glyphs.getBoundingBox (0, -1, true).getWidth());
+    return cached;
+}
+
+void TaskListComponent::updateSprites (float scale)
+{
+    if (sprites.scale == scale)
+        return;
+
+    sprites.scale = scale;
+    const auto checkbox = getCheckboxBounds (0);
+
+    sprites.checkbox = renderSprite (checkbox, scale, [] (juce::Graphics& g, juce::Rectangle<float> cb)
+    {
+        g.setColour (kBorder);
+        g.drawRoundedRectangle (cb, 3.0f, 1.0f);
+    });
+
+    sprites.checkedBox = renderSprite (checkbox, scale, [] (juce::Graphics& g, juce::Rectangle<float> cb)
+    {
+        g.setColour (kBorder);
+        g.drawRoundedRectangle (cb, 3.0f, 1.0f);
+
+        g.setColour (kAccent);
+        juce::Path check;
+        check.startNewSubPath (cb.getX() + 3.0f, cb.getCentreY());
+        check.lineTo (cb.getX() + 7.0f, cb.getBottom() - 4.0f);
+        check.lineTo (cb.getRight() - 3.0f, cb.getY() + 3.0f);
+        g.strokePath (check, juce::PathStrokeType (2.0f));
+    });
+
+    sprites.deleteButton = renderSprite (getDeleteBounds (0), scale, [] (juce::Graphics& g, juce::Rectangle<float> del)
+    {
+        g.setColour (kDanger);
+        g.drawRoundedRectangle (del, 4.0f, 1.0f);
+        g.drawLine (del.getX() + 5.0f, del.getY() + 5.0f, del.getRight() - 5.0f, del.getBottom() - 5.0f, 1.2f);
+        g.drawLine (del.getRight() - 5.0f, del.getY() + 5.0f, del.getX() + 5.0f, del.getBottom() - 5.0f, 1.2f);
+    });
 }
 
 juce::Rectangle<float> TaskListComponent::getCheckboxBounds (int row) const
@@ -316,6 +700,12 @@ juce::Rectangle<float> TaskListComponent::getDeleteBounds (int row) const
     return { (float) getWidth() - 30.0f, y + 8.0f, 18.0f, 18.0f };
 }
 
+juce::Rectangle<float> TaskListComponent::getPositionBounds (int row) const
+{
+    const float y = (float) row * (float) rowHeight;
+    return { (float) getWidth() - 96.0f, y, 58.0f, (float) rowHeight };
+}
+
 TodoListNativeAudioProcessorEditor::TodoListNativeAudioProcessorEditor (TodoListNativeAudioProcessor& p)
     : AudioProcessorEditor (&p), audioProcessor (p), taskList (p)
 {
@@ -329,6 +719,16 @@ TodoListNativeAudioProcessorEditor::TodoListNativeAudioProcessorEditor (TodoList
     input.setColour (juce::TextEditor::outlineColourId, kBorder);
     input.setTextToShowWhenEmpty ("type task and press enter", kMuted);
     input.onReturnKey = [this] { addFromInput(); };
+    taskList.takeUndoKeysFrom (input);
+
+    addAndMakeVisible (filterBox);
+    filterBox.setColour (juce::TextEditor::backgroundColourId, kPanel.darker (0.2f));
+    filterBox.setColour (juce::TextEditor::textColourId, kText);
+    filterBox.setColour (juce::TextEditor::outlineColourId, kBorder);
+    filterBox.setTextToShowWhenEmpty ("filter", kMuted);
+    filterBox.onTextChange = [this] { taskList.setFilter (filterBox.getText().trim()); };
+    filterBox.onEscapeKey = [this] { filterBox.clear(); taskList.setFilter ({}); };
+    taskList.takeUndoKeysFrom (filterBox);
 
     addAndMakeVisible (addButton);
     addButton.setColour (juce::TextButton::buttonColourId, kAccent.darker (0.25f));
@@ -336,6 +736,15 @@ TodoListNativeAudioProcessorEditor::TodoListNativeAudioProcessorEditor (TodoList
     addButton.setColour (juce::TextButton::textColourOffId, kText);
     addButton.addListener (this);
 
+    addAndMakeVisible (markButton);
+    markButton.addListener (this);
+
+    addAndMakeVisible (timeButton);
+    timeButton.addListener (this);
+
+    addAndMakeVisible (archiveButton);
+    archiveButton.addListener (this);
+
     addAndMakeVisible (collapseButton);
     collapseButton.addListener (this);
 
@@ -347,15 +756,7 @@ TodoListNativeAudioProcessorEditor::TodoListNativeAudioProcessorEditor (TodoList
     stats.setColour (juce::Label::textColourId, kMuted);
     stats.setJustificationType (juce::Justification::centredRight);
 
-    auto safeThis = juce::Component::SafePointer<TodoListNativeAudioProcessorEditor> (this);
-    audioProcessor.onTasksChanged = [safeThis]
-    {
-        juce::MessageManager::callAsync ([safeThis]
-        {
-            if (safeThis.getComponent() != nullptr)
-                safeThis->refreshFromState();
-        });
-    };
+    audioProcessor.addListener (this);
 
     setSize (430, 360);
     refreshFromState();
@@ -364,7 +765,7 @@ TodoListNativeAudioProcessorEditor::TodoListNativeAudioProcessorEditor (TodoList
 TodoListNativeAudioProcessorEditor::~TodoListNativeAudioProcessorEditor()
 {
     closeDetachedWindow();
-    audioProcessor.onTasksChanged = nullptr;
+    audioProcessor.removeListener (this);
 }
 
 void TodoListNativeAudioProcessorEditor::paint (juce::Graphics& g)
@@ -388,7 +789,11 @@ void TodoListNativeAudioProcessorEditor::resized()
         stats.setVisible (false);
         viewport.setVisible (false);
         input.setVisible (false);
+        filterBox.setVisible (false);
         addButton.setVisible (false);
+        markButton.setVisible (false);
+        timeButton.setVisible (false);
+        archiveButton.setVisible (false);
         return;
     }
 
@@ -397,16 +802,47 @@ void TodoListNativeAudioProcessorEditor::resized()
     collapseButton.setBounds (header.removeFromRight (100));
     stats.setBounds (header.removeFromRight (160));
 
+    if (perfTraceOverlay != nullptr)
+        perfTraceOverlay->setBounds (area.reduced (10, 0).withTrimmedTop (36).withTrimmedBottom (40));
+
     if (audioProcessor.getCollapsed())
         return;
 
     auto inputRow = area.removeFromBottom (34);
     addButton.setBounds (inputRow.removeFromRight (68));
+    markButton.setBounds (inputRow.removeFromRight (56));
+    archiveButton.setBounds (inputRow.removeFromRight (96));
     input.setBounds (inputRow.reduced (0, 2));
+    auto filterRow = area.removeFromTop (30);
+    timeButton.setBounds (filterRow.removeFromRight (56));
+    filterBox.setBounds (filterRow.reduced (0, 2));
     viewport.setBounds (area.reduced (0, 4));
     taskList.setSize (viewport.getWidth() - 8, taskList.getPreferredHeight());
 }
 
+bool TodoListNativeAudioProcessorEditor::keyPressed (const juce::KeyPress& key)
+{
+    if (key == juce::KeyPress ('r', juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier, 0))
+    {
+        taskList.setShowRepaintRegions (! taskList.isShowingRepaintRegions());
+        return true;
+    }
+
+    if (key == juce::KeyPress ('p', juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier, 0))
+    {
+        togglePerfTraceOverlay();
+        return true;
+    }
+
+    if (key == juce::KeyPress ('t', juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier, 0))
+    {
+        savePerfTrace();
+        return true;
+    }
+
+    return false;
+}
+
 void TodoListNativeAudioProcessorEditor::buttonClicked (juce::Button* button)
 {
     if (button == &addButton)
@@ -421,6 +857,25 @@ void TodoListNativeAudioProcessorEditor::buttonClicked (juce::Button* button)
         return;
     }
 
+    if (button == &archiveButton)
+    {
+        showArchive();
+        return;
+    }
+
+    if (button == &markButton)
+    {
+        audioProcessor.requestMarker (input.getText());
+        input.clear();
+        return;
+    }
+
+    if (button == &timeButton)
+    {
+        showTimeMenu();
+        return;
+    }
+
     if (button == &collapseButton)
     {
         audioProcessor.setCollapsed (! audioProcessor.getCollapsed());
@@ -428,8 +883,18 @@ void TodoListNativeAudioProcessorEditor::buttonClicked (juce::Button* button)
     }
 }
 
+void TodoListNativeAudioProcessorEditor::tasksChanged (const TaskChangeSet& changes)
+{
+    updateStats();
+
+    if (changes.collapsedChanged)
+        updateCollapsedLayout();
+}
+
 void TodoListNativeAudioProcessorEditor::refreshFromState()
 {
+    TODOLIST_TRACE_SCOPE ("refreshFromState");
+
     taskList.refreshSize();
     updateStats();
     updateCollapsedLayout();
@@ -454,7 +919,11 @@ void TodoListNativeAudioProcessorEditor::updateCollapsedLayout()
     collapseButton.setButtonText (isCollapsed ? "expand" : "collapse");
     viewport.setVisible (! isCollapsed);
     input.setVisible (! isCollapsed);
+    filterBox.setVisible (! isCollapsed);
     addButton.setVisible (! isCollapsed);
+    markButton.setVisible (! isCollapsed);
+    timeButton.setVisible (! isCollapsed);
+    archiveButton.setVisible (! isCollapsed);
 
     const int width = 430;
     const int targetHeight = isCollapsed ? 56 : 360;
@@ -466,14 +935,52 @@ void TodoListNativeAudioProcessorEditor::updateCollapsedLayout()
 
 void TodoListNativeAudioProcessorEditor::updateStats()
 {
-    const auto total = audioProcessor.getNumTasks();
-    int active = 0;
-    for (int i = 0; i < total; ++i)
-        if (! audioProcessor.getTask (i).done)
-            ++active;
-
-    stats.setText (juce::String (active) + " active | " + juce::String (total - active) + " done",
+    const auto taskStats = audioProcessor.getStats();
+    stats.setText (juce::String (taskStats.active) + " active | " + juce::String (taskStats.done) + " done",
                    juce::dontSendNotification);
+    archiveButton.setButtonText ("archive (" + juce::String (taskStats.archived) + ")");
+}
+
+void TodoListNativeAudioProcessorEditor::togglePerfTraceOverlay()
+{
+    if (perfTraceOverlay != nullptr)
+    {
+        perfTraceOverlay.reset();
+        return;
+    }
+
+    perfTraceOverlay = std::make_unique<PerfTraceOverlay>();
+    addAndMakeVisible (*perfTraceOverlay);
+    resized();
+}
+
+void TodoListNativeAudioProcessorEditor::savePerfTrace()
+{
+    const auto file = juce::File::getSpecialLocation (juce::File::userDesktopDirectory)
+                          .getNonexistentChildFile ("todo-list-trace", ".json");
+    const auto saved = PerfTrace::writeChromeTrace (file);
+
+    if (perfTraceOverlay != nullptr)
+        perfTraceOverlay->setStatus (saved ? "saved " + file.getFileName() : juce::String ("couldn't save the trace"));
+}
+
+void TodoListNativeAudioProcessorEditor::showArchive()
+{
+    juce::CallOutBox::launchAsynchronously (std::make_unique<ArchiveViewer> (*audioProcessor.getArchive()),
+                                            archiveButton.getScreenBounds(), nullptr);
+}
+
+void TodoListNativeAudioProcessorEditor::showTimeMenu()
+{
+    juce::PopupMenu menu;
+    menu.addItem ("jump to playhead", [this]
+    {
+        const auto id = audioProcessor.findTaskAtPlayhead();
+        if (id != TaskId::invalid)
+            taskList.showTask (id);
+    });
+    menu.addItem ("sort by time", [this] { audioProcessor.sortTasksByPosition(); });
+    menu.showMenuAsync (juce::PopupMenu::Options().withTargetComponent (&timeButton));
 }
 
 void TodoListNativeAudioProcessorEditor::toggleDetachedWindow()
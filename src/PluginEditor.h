@@ -3,20 +3,34 @@
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
 
-class TaskListComponent final : public juce::Component
+class PerfTraceOverlay;
+
+class TaskListComponent final : public juce::Component,
+                                private juce::KeyListener,
+                                private TodoListNativeAudioProcessor::Listener
 {
 public:
     explicit TaskListComponent (TodoListNativeAudioProcessor& processorRef);
+    ~TaskListComponent() override;
 
     void paint (juce::Graphics& g) override;
     void resized() override;
     void mouseDown (const juce::MouseEvent& event) override;
     void mouseDrag (const juce::MouseEvent& event) override;
     void mouseUp (const juce::MouseEvent& event) override;
+    bool keyPressed (const juce::KeyPress& key) override;
+
+    void takeUndoKeysFrom (juce::TextEditor& textBox);
 
     int getPreferredHeight() const;
     void refreshSize();
 
+    void setFilter (const juce::String& newFilter);
+    void showTask (TaskId id);
+
+    void setShowRepaintRegions (bool shouldShow);
+    bool isShowingRepaintRegions() const noexcept { return showRepaintRegions; }
+
 private:
     enum class HitZone
     {
@@ -29,25 +43,60 @@ private:
     struct HitInfo
     {
         int index = -1;
+        TaskId id = TaskId::invalid;
         HitZone zone = HitZone::None;
     };
 
+    struct CachedRow
+    {
+        juce::String text;
+        int width = -1;
+        bool hasPosition = false;
+        juce::GlyphArrangement glyphs;
+        float textWidth = 0.0f;
+        juce::uint32 lastPainted = 0;
+    };
+
+    struct IconSprites
+    {
+        float scale = 0.0f;
+        juce::Image checkbox, checkedBox, deleteButton;
+    };
+
     TodoListNativeAudioProcessor& processor;
+    std::unordered_map<TaskId, CachedRow> rowCache;
+    juce::String filter;
+    TodoListNativeAudioProcessor::FoundTasks filteredTasks;
+    IconSprites sprites;
+    juce::uint32 paintCount = 0;
     int rowHeight = 32;
     int dragFrom = -1;
     int dragOver = -1;
     bool dragging = false;
+    bool showRepaintRegions = false;
     HitInfo pressed;
 
-    HitInfo hitAt (juce::Point<float> p) const;
+    bool keyPressed (const juce::KeyPress& key, juce::Component* origin) override;
+    void tasksChanged (const TaskChangeSet& changes) override;
+    void repaintRows (juce::Range<int> rows);
+    int getNumRows() const;
+    std::optional<TaskRef> getTaskInRow (const TaskSnapshot& snapshot, int row) const;
+    HitInfo hitAt (juce::Point<float> p, const TaskSnapshot& snapshot) const;
+    juce::Rectangle<int> getRowBounds (juce::Range<int> rows) const;
+    juce::Range<int> getRowsIntersecting (juce::Rectangle<int> area) const;
+    juce::Rectangle<int> getTextArea (int row, bool hasPosition) const;
+    const CachedRow& getCachedRow (const TaskRef& task);
+    void updateSprites (float scale);
     juce::Rectangle<float> getCheckboxBounds (int row) const;
     juce::Rectangle<float> getDeleteBounds (int row) const;
+    juce::Rectangle<float> getPositionBounds (int row) const;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TaskListComponent)
 };
 
 class TodoListNativeAudioProcessorEditor final : public juce::AudioProcessorEditor,
-                                                 private juce::Button::Listener
+                                                 private juce::Button::Listener,
+                                                 private TodoListNativeAudioProcessor::Listener
 {
 public:
     explicit TodoListNativeAudioProcessorEditor (TodoListNativeAudioProcessor&);
@@ -55,26 +104,37 @@ public:
 
     void paint (juce::Graphics&) override;
     void resized() override;
+    bool keyPressed (const juce::KeyPress& key) override;
 
 private:
     TodoListNativeAudioProcessor& audioProcessor;
     TaskListComponent taskList;
     juce::Viewport viewport;
     juce::TextEditor input;
+    juce::TextEditor filterBox;
     juce::TextButton addButton { "add" };
+    juce::TextButton markButton { "mark" };
+    juce::TextButton timeButton { "time" };
+    juce::TextButton archiveButton { "archive" };
     juce::TextButton collapseButton { "collapse" };
     juce::TextButton popoutButton { "pop out" };
     juce::Label stats;
     std::unique_ptr<juce::DocumentWindow> detachedWindow;
+    std::unique_ptr<PerfTraceOverlay> perfTraceOverlay;
     bool mainPopOnlyMode = false;
     bool collapsedBeforePopout = false;
 
     void buttonClicked (juce::Button* button) override;
+    void tasksChanged (const TaskChangeSet& changes) override;
     void refreshFromState();
     void addFromInput();
     void updateCollapsedLayout();
     void updateStats();
     void updateMainWindowMode();
+    void showArchive();
+    void showTimeMenu();
+    void togglePerfTraceOverlay();
+    void savePerfTrace();
     void toggleDetachedWindow();
     void closeDetachedWindow();
 
@@ -1,215 +1,1812 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "PerfTrace.h"
+
+namespace
+{
+// Binary state layout, all integers little-endian:
+//   magic "TDLB", uint32 format version, uint8 flags (bit 0 = collapsed),
+//   compressed-int task count, packed done bits (task i -> byte i / 8, bit i % 8),
+//   then per task a compressed-int byte length followed by that many UTF-8 bytes.
+// Version 2 appends the archive as written by TaskArchive::writeTo. Version 3 follows it
+// with the playhead positions: a compressed-int count, then per task that has one its
+// compressed-int index, a uint8 of the fields present (bit 0 = time in seconds, bit 1 = PPQ,
+// bit 2 = bar) and those fields as a double, a double and an int64. The oldest version
+// that can hold the state is the one written, so older builds can read it.
+constexpr char kBinaryStateMagic[] = { 'T', 'D', 'L', 'B' };
+constexpr int kBinaryStateVersion = 3;
+constexpr int kBinaryStateVersionWithoutPositions = 2;
+constexpr int kBinaryStateVersionWithoutArchive = 1;
+constexpr juce::uint8 kCollapsedFlag = 1;
+
+constexpr juce::uint8 kPositionHasTime = 1;
+constexpr juce::uint8 kPositionHasPpq = 2;
+constexpr juce::uint8 kPositionHasBar = 4;
+constexpr juce::uint8 kPlayheadPublished = 0x80;
+
+constexpr int kMarkerPollIntervalMs = 20;
+constexpr juce::uint32 kMarkerTimeoutMs = 1000;
+
+constexpr int kDefaultUndoMemoryLimit = 4 * 1024 * 1024;
+
+juce::uint8 getPositionFields (const TaskPosition& position) noexcept
+{
+    return (juce::uint8) ((position.timeInSeconds ? kPositionHasTime : 0)
+                          | (position.ppq ? kPositionHasPpq : 0)
+                          | (position.bar ? kPositionHasBar : 0));
+}
+
+std::optional<double> getPositionField (const TaskPosition& position, int field) noexcept
+{
+    switch (field)
+    {
+        case 0:     return position.timeInSeconds;
+        case 1:     return position.ppq;
+        default:    return position.bar ? std::optional<double> ((double) *position.bar) : std::nullopt;
+    }
+}
+
+// Orders by the first of time, PPQ and bar a task has, so the order stays total for
+// any mix of fields.
+std::pair<int, double> getPositionKey (const TaskPosition* position) noexcept
+{
+    if (position != nullptr)
+        for (int field = 0; field < 3; ++field)
+            if (const auto value = getPositionField (*position, field))
+                return { field, *value };
+
+    return { 3, 0.0 };
+}
+
+std::optional<double> toFiniteValue (const juce::Optional<double>& value) noexcept
+{
+    if (value.hasValue() && std::isfinite (*value))
+        return *value;
+
+    return std::nullopt;
+}
+
+juce::String toJsonNumber (double value)
+{
+    return juce::String (value, 6).trimCharactersAtEnd ("0").trimCharactersAtEnd (".");
+}
+
+void writeJsonPosition (juce::OutputStream& out, const TaskPosition& position)
+{
+    const char* separator = "";
+    out << '{';
+
+    if (position.timeInSeconds)
+    {
+        out << "\"time\": " << toJsonNumber (*position.timeInSeconds);
+        separator = ", ";
+    }
+
+    if (position.ppq)
+    {
+        out << separator << "\"ppq\": " << toJsonNumber (*position.ppq);
+        separator = ", ";
+    }
+
+    if (position.bar)
+        out << separator << "\"bar\": " << juce::String (*position.bar);
+
+    out << '}';
+}
+
+// Matches juce::JSON::toString's escaping byte for byte.
+void writeJsonEscapedChar (juce::OutputStream& out, juce::uint32 value)
+{
+    constexpr char hexDigits[] = "0123456789abcdef";
+    const char escaped[] = { '\\', 'u',
+                             hexDigits[(value >> 12) & 15], hexDigits[(value >> 8) & 15],
+                             hexDigits[(value >> 4) & 15], hexDigits[value & 15] };
+    out.write (escaped, sizeof (escaped));
+}
+
+void writeJsonString (juce::OutputStream& out, juce::CharPointer_UTF8 text)
+{
+    out << '"';
+
+    const auto* pos = text.getAddress();
+    const auto* runStart = pos;
+
+    for (;;)
+    {
+        const auto byte = (juce::uint8) *pos;
+
+        if (byte >= 32 && byte < 127 && byte != '"' && byte != '\\')
+        {
+            ++pos;
+            continue;
+        }
+
+        out.write (runStart, (size_t) (pos - runStart));
+
+        if (byte == 0)
+            break;
+
+        juce::CharPointer_UTF8 charPointer (pos);
+        const auto c = (juce::uint32) charPointer.getAndAdvance();
+        pos = charPointer.getAddress();
+        runStart = pos;
+
+        switch (c)
+        {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\a': out << "\\a"; break;
+            case '\b': out << "\\b"; break;
+            case '\f': out << "\\f"; break;
+            case '\t': out << "\\t"; break;
+            case '\r': out << "\\r"; break;
+            case '\n': out << "\\n"; break;
+
+            default:
+                if (c >= 0x10000)
+                {
+                    writeJsonEscapedChar (out, 0xd800 + ((c - 0x10000) >> 10));
+                    writeJsonEscapedChar (out, 0xdc00 + ((c - 0x10000) & 0x3ff));
+                }
+                else
+                {
+                    writeJsonEscapedChar (out, c);
+                }
+                break;
+        }
+    }
+
+    out << '"';
+}
+
+class JsonStateReader
+{
+public:
+    JsonStateReader (const char* data, size_t numBytes)
+        : pos (data), end (data + numBytes)
+    {
+    }
+
+    bool read (juce::Array<TodoTask>& destTasks, bool& isCollapsed, TaskArchive::Ptr& destArchive)
+    {
+        return readObject ([&] (const juce::String& key)
+        {
+            if (key == "collapsed")
+                return readBool (isCollapsed);
+
+            if (key == "archive")
+                return readArchive (destArchive);
+
+            if (key == "tasks")
+            {
+                destTasks.clear();
+                return readTasks (destTasks);
+            }
+
+            return skipValue (0);
+        });
+    }
+
+private:
+    static constexpr int maxNestingDepth = 64;
+
+    const char* pos;
+    const char* end;
+    juce::MemoryOutputStream scratch;
+
+    char peek()
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n'))
+            ++pos;
+        return pos < end ? *pos : 0;
+    }
+
+    bool skip (char expected)
+    {
+        if (peek() != expected)
+            return false;
+        ++pos;
+        return true;
+    }
+
+    bool skipLiteral (const char* literal)
+    {
+        const auto length = (size_t) std::strlen (literal);
+        if ((size_t) (end - pos) < length || std::memcmp (pos, literal, length) != 0)
+            return false;
+        pos += length;
+        return true;
+    }
+
+    template <typename PropertyHandler>
+    bool readObject (PropertyHandler&& handleProperty)
+    {
+        if (! skip ('{'))
+            return false;
+
+        if (skip ('}'))
+            return true;
+
+        juce::String key;
+        for (;;)
+        {
+            if (peek() != '"' || ! readString (&key) || ! skip (':') || ! handleProperty (key))
+                return false;
+
+            if (skip ('}'))
+                return true;
+            if (! skip (','))
+                return false;
+        }
+    }
+
+    bool readTasks (juce::Array<TodoTask>& destTasks)
+    {
+        if (peek() != '[')
+            return skipValue (0);
+
+        ++pos;
+        if (skip (']'))
+            return true;
+
+        for (;;)
+        {
+            if (peek() == '{')
+            {
+                TodoTask task;
+                const auto ok = readObject ([&] (const juce::String& key)
+                {
+                    if (key == "text")
+                        return readText (task.text);
+                    if (key == "done")
+                        return readBool (task.done);
+                    if (key == "position")
+                        return readPosition (task.position);
+                    return skipValue (0);
+                });
+
+                if (! ok)
+                    return false;
+
+                if (! task.text.isEmpty())
+                    destTasks.add (task);
+            }
+            else if (! skipValue (0))
+            {
+                return false;
+            }
+
+            if (skip (']'))
+                return true;
+            if (! skip (','))
+                return false;
+        }
+    }
+
+    bool readArchive (TaskArchive::Ptr& destArchive)
+    {
+        if (peek() != '"')
+            return skipValue (0);
+
+        juce::String base64;
+        if (! readString (&base64))
+            return false;
+
+        juce::MemoryOutputStream decoded;
+        if (juce::Base64::convertFromBase64 (decoded, base64))
+        {
+            juce::MemoryInputStream stream (decoded.getData(), decoded.getDataSize(), false);
+            destArchive = TaskArchive::readFrom (stream);
+        }
+
+        return true;
+    }
+
+    bool readPosition (std::optional<TaskPosition>& dest)
+    {
+        if (peek() != '{')
+            return skipValue (0);
+
+        TaskPosition position;
+        const auto ok = readObject ([&] (const juce::String& key)
+        {
+            if (key == "time")
+                return readNumber (position.timeInSeconds);
+            if (key == "ppq")
+                return readNumber (position.ppq);
+            if (key == "bar")
+                return readNumber (position.bar);
+            return skipValue (0);
+        });
+
+        if (ok && ! position.isEmpty())
+            dest = position;
+
+        return ok;
+    }
+
+    template <typename Value>
+    bool readNumber (std::optional<Value>& dest)
+    {
+        const auto c = peek();
+
+        if (c != '-' && (c < '0' || c > '9'))
+            return skipValue (0);
+
+        const auto* start = pos;
+        if (! skipNumber())
+            return false;
+
+        const auto text = juce::String::fromUTF8 (start, (int) (pos - start));
+
+        if constexpr (std::is_integral_v<Value>)
+            dest = (Value) text.getLargeIntValue();
+        else
+            dest = (Value) text.getDoubleValue();
+
+        return true;
+    }
+
+    bool readText (juce::String& dest)
+    {
+        const auto c = peek();
+
+        if (c == '"')
+            return readString (&dest);
+
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            const auto* start = pos;
+            if (! skipNumber())
+                return false;
+            dest = juce::String::fromUTF8 (start, (int) (pos - start));
+            return true;
+        }
+
+        if (c == 't' || c == 'f')
+        {
+            bool value = false;
+            if (! readBool (value))
+                return false;
+            dest = value ? "1" : "0";
+            return true;
+        }
+
+        dest = {};
+        return skipValue (0);
+    }
+
+    bool readBool (bool& dest)
+    {
+        const auto c = peek();
+
+        if (skipLiteral ("true"))
+        {
+            dest = true;
+            return true;
+        }
+
+        if (skipLiteral ("false") || skipLiteral ("null"))
+        {
+            dest = false;
+            return true;
+        }
+
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            const auto* start = pos;
+            if (! skipNumber())
+                return false;
+            dest = juce::String::fromUTF8 (start, (int) (pos - start)).getDoubleValue() != 0.0;
+            return true;
+        }
+
+        if (c == '"')
+        {
+            juce::String text;
+            if (! readString (&text))
+                return false;
+            const auto trimmed = text.trim();
+            dest = trimmed.getIntValue() != 0 || trimmed.equalsIgnoreCase ("true") || trimmed.equalsIgnoreCase ("yes");
+            return true;
+        }
+
+        dest = false;
+        return skipValue (0);
+    }
+
+    bool skipNumber()
+    {
+        const auto* start = pos;
+        while (pos < end && ((*pos >= '0' && *pos <= '9') || *pos == '-' || *pos == '+' || *pos == '.' || *pos == 'e' || *pos == 'E'))
+            ++pos;
+        return pos > start;
+    }
+
+    bool skipValue (int depth)
+    {
+        if (depth > maxNestingDepth)
+            return false;
+
+        const auto c = peek();
+
+        if (c == '"')
+            return readString (nullptr);
+
+        if (c == '{')
+            return readObject ([&] (const juce::String&) { return skipValue (depth + 1); });
+
+        if (c == '[')
+        {
+            ++pos;
+            if (skip (']'))
+                return true;
+
+            for (;;)
+            {
+                if (! skipValue (depth + 1))
+                    return false;
+                if (skip (']'))
+                    return true;
+                if (! skip (','))
+                    return false;
+            }
+        }
+
+        if (c == '-' || (c >= '0' && c <= '9'))
+            return skipNumber();
+
+        return skipLiteral ("true") || skipLiteral ("false") || skipLiteral ("null");
+    }
+
+    bool readString (juce::String* dest)
+    {
+        ++pos;
+        const auto* start = pos;
+
+        while (pos < end && *pos != '"' && *pos != '\\' && *pos != 0)
+            ++pos;
+
+        if (pos < end && *pos == '"')
+        {
+            if (dest != nullptr)
+                *dest = juce::String::fromUTF8 (start, (int) (pos - start));
+            ++pos;
+            return true;
+        }
+
+        scratch.reset();
+        scratch.write (start, (size_t) (pos - start));
+
+        while (pos < end && *pos != 0)
+        {
+            const auto c = *pos++;
+
+            if (c == '"')
+            {
+                if (dest != nullptr)
+                    *dest = juce::String::fromUTF8 (static_cast<const char*> (scratch.getData()), (int) scratch.getDataSize());
+                return true;
+            }
+
+            if (c != '\\')
+            {
+                scratch.writeByte (c);
+                continue;
+            }
+
+            if (pos >= end)
+                return false;
+
+            switch (const auto escaped = *pos++)
+            {
+                case 'a': scratch.writeByte ('\a'); break;
+                case 'b': scratch.writeByte ('\b'); break;
+                case 'f': scratch.writeByte ('\f'); break;
+                case 'n': scratch.writeByte ('\n'); break;
+                case 'r': scratch.writeByte ('\r'); break;
+                case 't': scratch.writeByte ('\t'); break;
+
+                case 'u':
+                {
+                    auto codePoint = readHex4();
+                    if (codePoint < 0)
+                        return false;
+
+                    if (codePoint >= 0xd800 && codePoint < 0xdc00 && end - pos >= 6 && pos[0] == '\\' && pos[1] == 'u')
+                    {
+                        pos += 2;
+                        const auto low = readHex4();
+                        if (low < 0xdc00 || low >= 0xe000)
+                            return false;
+                        codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                    }
+
+                    writeUTF8 ((juce::juce_wchar) codePoint);
+                    break;
+                }
+
+                default:
+                    scratch.writeByte (escaped);
+                    break;
+            }
+        }
+
+        return false;
+    }
+
+    int readHex4()
+    {
+        if (end - pos < 4)
+            return -1;
+
+        int value = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            const auto digit = juce::CharacterFunctions::getHexDigitValue ((juce::juce_wchar) (juce::uint8) *pos++);
+            if (digit < 0)
+                return -1;
+            value = (value << 4) | digit;
+        }
+
+        return value;
+    }
+
+    void writeUTF8 (juce::juce_wchar c)
+    {
+        char bytes[4];
+        juce::CharPointer_UTF8 dest (bytes);
+        dest.write (c);
+        scratch.write (bytes, juce::CharPointer_UTF8::getBytesRequiredFor (c));
+    }
+};
+
+bool canArchive (const TaskRef& task) noexcept
+{
+    return task.done && task.position == nullptr;
+}
+} // namespace
+
+class TodoListNativeAudioProcessor::StateLoadJob final : public juce::ThreadPoolJob
+{
+public:
+    StateLoadJob (TodoListNativeAudioProcessor& processorToUse, std::shared_ptr<PendingStateLoad> loadToParse)
+        : ThreadPoolJob ("todo list state load"), processor (processorToUse), load (std::move (loadToParse))
+    {
+    }
+
+    bool belongsTo (const TodoListNativeAudioProcessor& other) const noexcept   { return &processor == &other; }
+
+    JobStatus runJob() override
+    {
+        if (processor.pendingStateLoad.load() == load)
+        {
+            stateToTasks (load->bytes.getData(), load->bytes.getSize(), load->tasks, load->collapsed, load->archive);
+            load->parsed = true;
+            processor.publishPendingStateLoad (load);
+        }
+
+        return jobHasFinished;
+    }
+
+private:
+    TodoListNativeAudioProcessor& processor;
+    std::shared_ptr<PendingStateLoad> load;
+};
 
 TodoListNativeAudioProcessor::TodoListNativeAudioProcessor()
     : AudioProcessor (BusesProperties().withInput ("Input", juce::AudioChannelSet::stereo(), true)
                                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true))
 {
+    setUndoMemoryLimit (kDefaultUndoMemoryLimit);
+}
+
+TodoListNativeAudioProcessor::~TodoListNativeAudioProcessor()
+{
+    // A load that's already being parsed sees it's no longer current and doesn't publish.
+    {
+        const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+        pendingStateLoad.store (nullptr);
+    }
+
+    // The pool is shared between instances, so only this one's jobs are removed.
+    struct OwnJobs final : public juce::ThreadPool::JobSelector
+    {
+        explicit OwnJobs (const TodoListNativeAudioProcessor& p) : processor (p) {}
+
+        bool isJobSuitable (juce::ThreadPoolJob* job) override
+        {
+            const auto* loadJob = dynamic_cast<StateLoadJob*> (job);
+            return loadJob != nullptr && loadJob->belongsTo (processor);
+        }
+
+        const TodoListNativeAudioProcessor& processor;
+    };
+
+    OwnJobs ownJobs (*this);
+    stateLoadPool->removeAllJobs (false, -1, &ownJobs);
+}
+
+const juce::String TodoListNativeAudioProcessor::getName() const
+{
+    return JucePlugin_Name;
+}
+
+bool TodoListNativeAudioProcessor::acceptsMidi() const { return false; }
+bool TodoListNativeAudioProcessor::producesMidi() const { return false; }
+bool TodoListNativeAudioProcessor::isMidiEffect() const { return false; }
+double TodoListNativeAudioProcessor::getTailLengthSeconds() const { return 0.0; }
+
+int TodoListNativeAudioProcessor::getNumPrograms() { return 1; }
+int TodoListNativeAudioProcessor::getCurrentProgram() { return 0; }
+void TodoListNativeAudioProcessor::setCurrentProgram (int) {}
+const juce::String TodoListNativeAudioProcessor::getProgramName (int) { return {}; }
+void TodoListNativeAudioProcessor::changeProgramName (int, const juce::String&) {}
+
+void TodoListNativeAudioProcessor::prepareToPlay (double, int) {}
+void TodoListNativeAudioProcessor::releaseResources() {}
+
+bool TodoListNativeAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
+{
+    const auto output = layouts.getMainOutputChannelSet();
+    return ! output.isDisabled() && layouts.getMainInputChannelSet() == output;
+}
+
+bool TodoListNativeAudioProcessor::supportsDoublePrecisionProcessing() const { return true; }
+
+void TodoListNativeAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer&)
+{
+    passThrough (buffer);
+}
+
+void TodoListNativeAudioProcessor::processBlock (juce::AudioBuffer<double>& buffer, juce::MidiBuffer&)
+{
+    passThrough (buffer);
+}
+
+template <typename SampleType>
+void TodoListNativeAudioProcessor::passThrough (juce::AudioBuffer<SampleType>& buffer) noexcept
+{
+    TODOLIST_REALTIME_SECTION;
+    TODOLIST_TRACE_REALTIME_SCOPE ("processBlock");
+
+    const auto position = readPlayhead();
+    publishPlayhead (position);
+    stampMarkers (position);
+
+    for (auto channel = getTotalNumInputChannels(); channel < getTotalNumOutputChannels(); ++channel)
+        buffer.clear (channel, 0, buffer.getNumSamples());
+}
+
+// Audio thread only; the playhead is only valid during processBlock.
+TaskPosition TodoListNativeAudioProcessor::readPlayhead() noexcept
+{
+    TaskPosition position;
+
+    if (auto* playHead = getPlayHead())
+    {
+        if (const auto info = playHead->getPosition())
+        {
+            position.timeInSeconds = toFiniteValue (info->getTimeInSeconds());
+            position.ppq = toFiniteValue (info->getPpqPosition());
+
+            if (const auto bar = info->getBarCount())
+                position.bar = *bar;
+        }
+    }
+
+    return position;
+}
+
+void TodoListNativeAudioProcessor::publishPlayhead (const TaskPosition& position) noexcept
+{
+    // Only the audio thread writes, so like the stats this needs no lock.
+    const auto sequence = playheadSequence.load (std::memory_order_relaxed);
+
+    playheadSequence.store (sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    playheadFields.store ((juce::uint8) (getPositionFields (position) | kPlayheadPublished), std::memory_order_relaxed);
+    playheadTime.store (position.timeInSeconds.value_or (0.0), std::memory_order_relaxed);
+    playheadPpq.store (position.ppq.value_or (0.0), std::memory_order_relaxed);
+    playheadBar.store (position.bar.value_or (0), std::memory_order_relaxed);
+    playheadSequence.store (sequence + 2, std::memory_order_release);
+}
+
+// A full queue leaves the remaining requests for a later block.
+void TodoListNativeAudioProcessor::stampMarkers (const TaskPosition& position) noexcept
+{
+    const auto requested = markersRequested.load (std::memory_order_acquire);
+
+    while (markersStamped != requested && markerStamps.push ({ markersStamped + 1, position }))
+        ++markersStamped;
+}
+
+std::optional<TaskPosition> TodoListNativeAudioProcessor::getPlayheadPosition() const noexcept
+{
+    for (;;)
+    {
+        const auto sequence = playheadSequence.load (std::memory_order_acquire);
+
+        if ((sequence & 1) != 0)
+            continue;
+
+        const auto fields = playheadFields.load (std::memory_order_relaxed);
+        const auto time = playheadTime.load (std::memory_order_relaxed);
+        const auto ppq = playheadPpq.load (std::memory_order_relaxed);
+        const auto bar = playheadBar.load (std::memory_order_relaxed);
+
+        std::atomic_thread_fence (std::memory_order_acquire);
+
+        if (playheadSequence.load (std::memory_order_relaxed) != sequence)
+            continue;
+
+        if ((fields & kPlayheadPublished) == 0)
+            return std::nullopt;
+
+        TaskPosition position;
+
+        if ((fields & kPositionHasTime) != 0)
+            position.timeInSeconds = time;
+        if ((fields & kPositionHasPpq) != 0)
+            position.ppq = ppq;
+        if ((fields & kPositionHasBar) != 0)
+            position.bar = bar;
+
+        return position;
+    }
+}
+
+void TodoListNativeAudioProcessor::requestMarker (const juce::String& text)
+{
+    const auto trimmed = text.trim();
+    markerRequests.push_back ({ ++lastMarkerRequest, trimmed.isNotEmpty() ? trimmed : juce::String ("marker"),
+                                juce::Time::getMillisecondCounter() });
+    markersRequested.store (lastMarkerRequest, std::memory_order_release);
+
+    // Restarting a running timer would keep postponing the next poll.
+    if (! isTimerRunning())
+        startTimer (kMarkerPollIntervalMs);
+}
+
+void TodoListNativeAudioProcessor::timerCallback()
+{
+    std::vector<std::pair<juce::String, std::optional<TaskPosition>>> marked;
+    PlayheadStampQueue::Stamp stamp;
+    size_t numAnswered = 0;
+
+    // Stamps arrive in request order, so one for an older request has already timed out.
+    while (markerStamps.pop (stamp))
+    {
+        if (numAnswered == markerRequests.size() || markerRequests[numAnswered].number != stamp.request)
+            continue;
+
+        marked.push_back ({ std::move (markerRequests[numAnswered++].text),
+                            stamp.position.isEmpty() ? std::nullopt : std::optional<TaskPosition> (stamp.position) });
+    }
+
+    const auto now = juce::Time::getMillisecondCounter();
+
+    for (; numAnswered < markerRequests.size() && now - markerRequests[numAnswered].requestedAt > kMarkerTimeoutMs; ++numAnswered)
+        marked.push_back ({ std::move (markerRequests[numAnswered].text), std::nullopt });
+
+    markerRequests.erase (markerRequests.begin(), markerRequests.begin() + (std::ptrdiff_t) numAnswered);
+
+    if (! marked.empty())
+    {
+        applyBatch ([&marked] (Batch& batch)
+        {
+            for (auto& [text, position] : marked)
+                batch.addTask (std::move (text), std::move (position));
+        });
+    }
+
+    if (markerRequests.empty())
+        stopTimer();
+}
+
+TaskId TodoListNativeAudioProcessor::findTaskAtPlayhead() const
+{
+    const auto playhead = getPlayheadPosition();
+    if (! playhead.has_value())
+        return TaskId::invalid;
+
+    const auto [field, playheadValue] = getPositionKey (&*playhead);
+    if (field > 2)
+        return TaskId::invalid;
+
+    auto found = TaskId::invalid;
+    auto foundValue = 0.0;
+
+    const auto current = snapshot.load();
+    current.visitTasks (0, current.size(), [&, field = field, playheadValue = playheadValue] (int, const TaskRef& task)
+    {
+        if (task.position == nullptr)
+            return;
+
+        const auto value = getPositionField (*task.position, field);
+
+        if (value.has_value() && *value <= playheadValue && (found == TaskId::invalid || *value >= foundValue))
+        {
+            found = task.id;
+            foundValue = *value;
+        }
+    });
+
+    return found;
+}
+
+void TodoListNativeAudioProcessor::sortTasksByPosition()
+{
+    applyBatch ([] (Batch& batch)
+    {
+        std::vector<std::tuple<int, double, int, TaskId>> order;
+        order.reserve ((size_t) batch.getNumTasks());
+
+        for (int i = 0; i < batch.getNumTasks(); ++i)
+        {
+            const auto task = batch.getTask (i);
+            const auto key = getPositionKey (task->position);
+            order.emplace_back (key.first, key.second, i, task->id);
+        }
+
+        std::sort (order.begin(), order.end());
+
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const auto id = std::get<3> (order[i]);
+
+            if (batch.getTaskIndex (id) != (int) i)
+                batch.moveTask (id, (int) i);
+        }
+    });
+}
+
+bool TodoListNativeAudioProcessor::hasEditor() const { return true; }
+
+juce::AudioProcessorEditor* TodoListNativeAudioProcessor::createEditor()
+{
+    return new TodoListNativeAudioProcessorEditor (*this);
+}
+
+template <typename EditFunction>
+bool TodoListNativeAudioProcessor::applyEdit (EditFunction&& edit)
+{
+    {
+        const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+        TaskSnapshotBuilder builder (snapshot.load(), &idIndex, &textIndex);
+        const auto loadedState = takePendingStateLoad (builder);
+
+        if (! edit (builder) && loadedState == nullptr)
+            return false;
+
+        publishSnapshot (builder.build());
+
+        if (loadedState != nullptr)
+            pendingStateLoad.store (nullptr);
+
+        queueChanges (builder.getChanges());
+    }
+
+    triggerAsyncUpdate();
+    return true;
+}
+
+// Called with writeLock held, so change sets are queued in version order.
+void TodoListNativeAudioProcessor::queueChanges (const TaskChangeSet& changes)
+{
+    const PerfTrace::TimedScopedLock sl (changeLock, "changeLock wait");
+    pendingChanges.append (changes);
+}
+
+void TodoListNativeAudioProcessor::handleAsyncUpdate()
+{
+    TaskChangeSet changes;
+
+    {
+        const PerfTrace::TimedScopedLock sl (changeLock, "changeLock wait");
+        std::swap (changes, pendingChanges);
+    }
+
+    if (! changes.isEmpty())
+        listeners.call ([&] (Listener& l) { l.tasksChanged (changes); });
+}
+
+void TodoListNativeAudioProcessor::addListener (Listener* listener)
+{
+    listeners.add (listener);
+}
+
+void TodoListNativeAudioProcessor::removeListener (Listener* listener)
+{
+    listeners.remove (listener);
+}
+
+TaskSnapshot TodoListNativeAudioProcessor::getSnapshot() const
+{
+    return snapshot.load();
+}
+
+TaskStats TodoListNativeAudioProcessor::getStats() const noexcept
+{
+    for (;;)
+    {
+        const auto sequence = statsSequence.load (std::memory_order_acquire);
+
+        if ((sequence & 1) != 0)
+            continue;
+
+        TaskStats stats;
+        stats.total = statsTotal.load (std::memory_order_relaxed);
+        stats.done = statsDone.load (std::memory_order_relaxed);
+        stats.active = stats.total - stats.done;
+        stats.textBytes = statsTextBytes.load (std::memory_order_relaxed);
+        stats.oldestOpenTask = (TaskId) statsOldestOpen.load (std::memory_order_relaxed);
+        stats.archived = statsArchived.load (std::memory_order_relaxed);
+
+        std::atomic_thread_fence (std::memory_order_acquire);
+
+        if (statsSequence.load (std::memory_order_relaxed) == sequence)
+            return stats;
+    }
+}
+
+void TodoListNativeAudioProcessor::publishSnapshot (const TaskSnapshot& newSnapshot)
+{
+    // Called with writeLock held, so there's only ever one writer.
+    const auto stats = newSnapshot.getStats();
+    const auto sequence = statsSequence.load (std::memory_order_relaxed);
+
+    statsSequence.store (sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    statsTotal.store (stats.total, std::memory_order_relaxed);
+    statsDone.store (stats.done, std::memory_order_relaxed);
+    statsTextBytes.store (stats.textBytes, std::memory_order_relaxed);
+    statsOldestOpen.store ((juce::uint64) stats.oldestOpenTask, std::memory_order_relaxed);
+    statsArchived.store (stats.archived, std::memory_order_relaxed);
+    statsSequence.store (sequence + 2, std::memory_order_release);
+
+    snapshot.store (newSnapshot);
+}
+
+int TodoListNativeAudioProcessor::getNumTasks() const
+{
+    return snapshot.load().size();
+}
+
+TodoListNativeAudioProcessor::Task TodoListNativeAudioProcessor::getTask (int index) const
+{
+    const auto current = snapshot.load();
+    if (auto task = current.getTask (index))
+        return task->toTask();
+    return {};
+}
+
+TaskId TodoListNativeAudioProcessor::addTask (juce::String text)
+{
+    auto id = TaskId::invalid;
+    applyBatch ([&] (Batch& batch) { id = batch.addTask (std::move (text)); });
+    return id;
+}
+
+void TodoListNativeAudioProcessor::setTaskDone (int index, bool done)
+{
+    applyBatch ([&] (Batch& batch) { batch.setTaskDone (index, done); });
+}
+
+void TodoListNativeAudioProcessor::removeTask (int index)
+{
+    applyBatch ([&] (Batch& batch) { batch.removeTask (index); });
+}
+
+void TodoListNativeAudioProcessor::moveTask (int from, int to)
+{
+    applyBatch ([&] (Batch& batch) { batch.moveTask (from, to); });
+}
+
+int TodoListNativeAudioProcessor::getTaskIndex (TaskId id) const
+{
+    const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+    return idIndex.indexOf (snapshot.load(), id);
+}
+
+void TodoListNativeAudioProcessor::setTaskDone (TaskId id, bool done)
+{
+    applyBatch ([&] (Batch& batch) { batch.setTaskDone (id, done); });
+}
+
+void TodoListNativeAudioProcessor::removeTask (TaskId id)
+{
+    applyBatch ([&] (Batch& batch) { batch.removeTask (id); });
+}
+
+void TodoListNativeAudioProcessor::moveTask (TaskId id, int to)
+{
+    applyBatch ([&] (Batch& batch) { batch.moveTask (id, to); });
+}
+
+TodoListNativeAudioProcessor::FoundTasks TodoListNativeAudioProcessor::findTasks (const juce::String& query, const FoundTasks* previousSearch) const
+{
+    if (query.isEmpty())
+        return {};
+
+    const TaskTextIndex::Query preparedQuery (query);
+    const auto contains = [&preparedQuery] (const TaskRef& task) { return preparedQuery.matches (task.text, task.numBytes); };
+
+    FoundTasks found;
+    found.query = query;
+
+    const auto addMatch = [&found] (int index, TaskId id)
+    {
+        found.ids.push_back (id);
+        found.indices.push_back (index);
+    };
+
+    const auto isFewOf = [] (size_t numTasks, const TaskSnapshot& list) { return numTasks <= (size_t) list.size() / 16; };
+
+    const auto canRefine = previousSearch != nullptr
+                        && previousSearch->query.isNotEmpty()
+                        && query.containsIgnoreCase (previousSearch->query);
+    bool refine = false;
+    bool hasCandidates = false;
+    std::vector<std::pair<int, TaskId>> matches;
+    std::vector<bool> isCandidate;
+
+    {
+        const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+        found.snapshot = snapshot.load();
+
+        // The candidates belong to the index, so they're only read while the lock is held.
+        const auto* candidates = textIndex.findCandidates (found.snapshot, preparedQuery);
+
+        refine = canRefine
+              && previousSearch->snapshot.getVersion() == found.snapshot.getVersion()
+              && (candidates == nullptr || previousSearch->size() <= candidates->size());
+
+        if (candidates != nullptr && ! refine)
+        {
+            hasCandidates = true;
+
+            if (isFewOf (candidates->size(), found.snapshot))
+            {
+                for (const auto id : *candidates)
+                    matches.emplace_back (idIndex.indexOf (found.snapshot, id), id);
+            }
+            else
+            {
+                juce::uint64 maxId = 0;
+                for (const auto id : *candidates)
+                    maxId = juce::jmax (maxId, (juce::uint64) id);
+
+                isCandidate.resize ((size_t) maxId + 1);
+                for (const auto id : *candidates)
+                    isCandidate[(size_t) id] = true;
+            }
+        }
+    }
+
+    if (refine)
+    {
+        const auto& current = found.snapshot;
+
+        if (isFewOf (previousSearch->size(), current))
+        {
+            for (size_t i = 0; i < previousSearch->size(); ++i)
+                if (const auto task = current.getTask (previousSearch->indices[i]); task.has_value() && contains (*task))
+                    addMatch (previousSearch->indices[i], task->id);
+
+            return found;
+        }
+
+        std::vector<bool> wasFound ((size_t) current.size());
+        for (const auto index : previousSearch->indices)
+            wasFound[(size_t) index] = true;
+
+        current.visitTasks (0, current.size(), [&] (int index, const TaskRef& task)
+        {
+            if (wasFound[(size_t) index] && contains (task))
+                addMatch (index, task.id);
+        });
+
+        return found;
+    }
+
+    const auto& current = found.snapshot;
+
+    if (! hasCandidates || ! isCandidate.empty())
+    {
+        current.visitTasks (0, current.size(), [&] (int index, const TaskRef& task)
+        {
+            const auto id = (size_t) task.id;
+
+            if ((! hasCandidates || (id < isCandidate.size() && isCandidate[id])) && contains (task))
+                addMatch (index, task.id);
+        });
+
+        return found;
+    }
+
+    std::sort (matches.begin(), matches.end());
+    matches.erase (std::unique (matches.begin(), matches.end()), matches.end());
+
+    for (const auto& [index, id] : matches)
+        if (const auto task = current.getTask (index); task.has_value() && contains (*task))
+            addMatch (index, id);
+
+    return found;
+}
+
+bool TodoListNativeAudioProcessor::getCollapsed() const noexcept
+{
+    return snapshot.load().getCollapsed();
+}
+
+void TodoListNativeAudioProcessor::setCollapsed (bool shouldCollapse)
+{
+    applyEdit ([shouldCollapse] (TaskSnapshotBuilder& builder)
+    {
+        if (builder.getCollapsed() == shouldCollapse)
+            return false;
+
+        builder.setCollapsed (shouldCollapse);
+        return true;
+    });
 }
 
-TodoListNativeAudioProcessor::~TodoListNativeAudioProcessor() = default;
+void TodoListNativeAudioProcessor::applyBatch (const std::function<void (Batch&)>& edits)
+{
+    applyEdit ([&] (TaskSnapshotBuilder& builder)
+    {
+        TaskEditLog log;
+        Batch batch (builder, log);
+        edits (batch);
+        addToUndoHistory (std::move (log), true);
+        return ! builder.getChanges().isEmpty();
+    });
 
-const juce::String TodoListNativeAudioProcessor::getName() const
+    archiveExcessDoneTasks();
+}
+
+void TodoListNativeAudioProcessor::archiveExcessDoneTasks()
 {
-    return JucePlugin_Name;
+    const auto maxDoneTasks = archiveThreshold.load();
+    if (maxDoneTasks <= 0 || getStats().done <= maxDoneTasks || isStateLoadPending())
+        return;
+
+    applyEdit ([&] (TaskSnapshotBuilder& builder)
+    {
+        // With writeLock held the builder starts from the published snapshot, so the
+        // done tasks can be found by walking that.
+        const auto current = snapshot.load();
+        const auto numExcess = current.getStats().done - maxDoneTasks / 2;
+        if (numExcess <= 0)
+            return false;
+
+        std::vector<TaskId> doneTasks;
+        doneTasks.reserve ((size_t) current.getStats().done);
+        current.visitTasks (0, current.size(), [&] (int, const TaskRef& task)
+        {
+            if (canArchive (task))
+                doneTasks.push_back (task.id);
+        });
+
+        const auto numToArchive = juce::jmin (numExcess, (int) doneTasks.size());
+        if (numToArchive <= 0)
+            return false;
+
+        const auto newest = doneTasks.begin() + numToArchive - 1;
+        std::nth_element (doneTasks.begin(), newest, doneTasks.end());
+        const auto newestToArchive = *newest;
+
+        TaskEditLog log;
+        const auto numArchived = log.archiveIf (builder, [=] (const TaskRef& task) { return canArchive (task) && task.id <= newestToArchive; });
+        addToUndoHistory (std::move (log), false);
+        return numArchived > 0;
+    });
 }
 
-bool TodoListNativeAudioProcessor::acceptsMidi() const { return false; }
-bool TodoListNativeAudioProcessor::producesMidi() const { return false; }
-bool TodoListNativeAudioProcessor::isMidiEffect() const { return false; }
-double TodoListNativeAudioProcessor::getTailLengthSeconds() const { return 0.0; }
+int TodoListNativeAudioProcessor::archiveDoneTasks()
+{
+    int numArchived = 0;
+    applyEdit ([&] (TaskSnapshotBuilder& builder)
+    {
+        TaskEditLog log;
+        numArchived = log.archiveIf (builder, canArchive);
+        addToUndoHistory (std::move (log), true);
+        return numArchived > 0;
+    });
+    return numArchived;
+}
 
-int TodoListNativeAudioProcessor::getNumPrograms() { return 1; }
-int TodoListNativeAudioProcessor::getCurrentProgram() { return 0; }
-void TodoListNativeAudioProcessor::setCurrentProgram (int) {}
-const juce::String TodoListNativeAudioProcessor::getProgramName (int) { return {}; }
-void TodoListNativeAudioProcessor::changeProgramName (int, const juce::String&) {}
+void TodoListNativeAudioProcessor::setArchiveThreshold (int maxDoneTasks) noexcept
+{
+    archiveThreshold = juce::jmax (0, maxDoneTasks);
+}
 
-void TodoListNativeAudioProcessor::prepareToPlay (double, int) {}
-void TodoListNativeAudioProcessor::releaseResources() {}
+int TodoListNativeAudioProcessor::getArchiveThreshold() const noexcept
+{
+    return archiveThreshold;
+}
 
-bool TodoListNativeAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
+TaskArchive::Ptr TodoListNativeAudioProcessor::getArchive() const
 {
-    return layouts.getMainInputChannelSet() == layouts.getMainOutputChannelSet()
-           && (layouts.getMainOutputChannelSet() == juce::AudioChannelSet::mono()
-               || layouts.getMainOutputChannelSet() == juce::AudioChannelSet::stereo());
+    return snapshot.load().getArchive();
 }
 
-void TodoListNativeAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer&)
+int TodoListNativeAudioProcessor::removeDoneTasks()
+{
+    int numRemoved = 0;
+    applyBatch ([&] (Batch& batch)
+    {
+        numRemoved = batch.removeTasksIf ([] (const TaskRef& task) { return task.done; });
+    });
+    return numRemoved;
+}
+
+void TodoListNativeAudioProcessor::setTasksDone (juce::Range<int> range, bool done)
+{
+    applyBatch ([&] (Batch& batch)
+    {
+        range = range.getIntersectionWith ({ 0, batch.getNumTasks() });
+
+        for (auto i = range.getStart(); i < range.getEnd(); ++i)
+            if (batch.getTask (i)->done != done)
+                batch.setTaskDone (i, done);
+    });
+}
+
+void TodoListNativeAudioProcessor::addTasks (const juce::StringArray& lines)
+{
+    applyBatch ([&] (Batch& batch)
+    {
+        for (const auto& line : lines)
+            batch.addTask (line);
+    });
+}
+
+//==============================================================================
+// The edits have already been made when the action is recorded, so only a perform()
+// that follows an undo() replays them.
+class TodoListNativeAudioProcessor::EditAction final : public juce::UndoableAction
+{
+public:
+    EditAction (TodoListNativeAudioProcessor& ownerToUse, TaskEditLog&& logToUse)
+        : owner (ownerToUse), log (std::move (logToUse))
+    {
+    }
+
+    bool perform() override
+    {
+        if (! isApplied)
+            owner.applyEdit ([this] (TaskSnapshotBuilder& builder) { log.redo (builder); return true; });
+
+        isApplied = true;
+        return true;
+    }
+
+    bool undo() override
+    {
+        owner.applyEdit ([this] (TaskSnapshotBuilder& builder) { log.undo (builder); return true; });
+        isApplied = false;
+        return true;
+    }
+
+    int getSizeInUnits() override
+    {
+        return (int) log.getSizeInBytes();
+    }
+
+private:
+    TodoListNativeAudioProcessor& owner;
+    TaskEditLog log;
+    bool isApplied = true;
+};
+
+// Called with writeLock held, so the history is recorded in the order edits were made.
+void TodoListNativeAudioProcessor::addToUndoHistory (TaskEditLog&& log, bool startsNewStep)
 {
-    juce::ScopedNoDenormals noDenormals;
-    for (int channel = 0; channel < getTotalNumOutputChannels(); ++channel)
+    if (log.isEmpty())
+        return;
+
+    // The UndoManager always keeps the latest transaction, so an oversized edit clears the
+    // history before it.
+    if (log.getSizeInBytes() > (size_t) undoMemoryLimit)
     {
-        auto* in = buffer.getReadPointer (channel);
-        auto* out = buffer.getWritePointer (channel);
-        juce::FloatVectorOperations::copy (out, in, buffer.getNumSamples());
+        undoManager.clearUndoHistory();
+        return;
     }
+
+    if (startsNewStep)
+        undoManager.beginNewTransaction();
+
+    undoManager.perform (new EditAction (*this, std::move (log)));
 }
 
-bool TodoListNativeAudioProcessor::hasEditor() const { return true; }
+bool TodoListNativeAudioProcessor::undo()
+{
+    const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+    return ! isStateLoadPending() && undoManager.undo();
+}
 
-juce::AudioProcessorEditor* TodoListNativeAudioProcessor::createEditor()
+bool TodoListNativeAudioProcessor::redo()
 {
-    return new TodoListNativeAudioProcessorEditor (*this);
+    const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+    return ! isStateLoadPending() && undoManager.redo();
 }
 
-int TodoListNativeAudioProcessor::getNumTasks() const
+bool TodoListNativeAudioProcessor::canUndo() const
 {
-    const juce::ScopedLock sl (taskLock);
-    return tasks.size();
+    const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+    return undoManager.canUndo();
 }
 
-TodoListNativeAudioProcessor::Task TodoListNativeAudioProcessor::getTask (int index) const
+bool TodoListNativeAudioProcessor::canRedo() const
 {
-    const juce::ScopedLock sl (taskLock);
-    if (! juce::isPositiveAndBelow (index, tasks.size()))
-        return {};
-    return tasks.getReference (index);
+    const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+    return undoManager.canRedo();
 }
 
-void TodoListNativeAudioProcessor::addTask (juce::String text)
+void TodoListNativeAudioProcessor::setUndoMemoryLimit (int maxBytes)
+{
+    const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+    undoMemoryLimit = juce::jmax (0, maxBytes);
+    undoManager.setMaxNumberOfStoredUnits (undoMemoryLimit, 1);
+}
+
+int TodoListNativeAudioProcessor::getUndoMemoryLimit() const noexcept
+{
+    return undoMemoryLimit;
+}
+
+//==============================================================================
+int TodoListNativeAudioProcessor::Batch::getNumTasks() const noexcept
+{
+    return builder.size();
+}
+
+std::optional<TaskRef> TodoListNativeAudioProcessor::Batch::getTask (int index) const noexcept
+{
+    return builder.getTask (index);
+}
+
+int TodoListNativeAudioProcessor::Batch::getTaskIndex (TaskId id) const
+{
+    return builder.indexOf (id);
+}
+
+TaskId TodoListNativeAudioProcessor::Batch::addTask (juce::String text, std::optional<TaskPosition> position)
 {
     text = text.trim();
     if (text.isEmpty())
-        return;
+        return TaskId::invalid;
 
-    {
-        const juce::ScopedLock sl (taskLock);
-        tasks.add ({ text, false });
-    }
-    if (onTasksChanged)
-        onTasksChanged();
+    return log.insert (builder, builder.size(), { std::move (text), false, TaskId::invalid, std::move (position) });
 }
 
-void TodoListNativeAudioProcessor::setTaskDone (int index, bool done)
+void TodoListNativeAudioProcessor::Batch::setTaskDone (int index, bool done)
 {
-    {
-        const juce::ScopedLock sl (taskLock);
-        if (! juce::isPositiveAndBelow (index, tasks.size()))
-            return;
-        tasks.getReference (index).done = done;
-    }
-    if (onTasksChanged)
-        onTasksChanged();
+    log.setDone (builder, index, done);
 }
 
-void TodoListNativeAudioProcessor::removeTask (int index)
+void TodoListNativeAudioProcessor::Batch::setTaskDone (TaskId id, bool done)
 {
-    {
-        const juce::ScopedLock sl (taskLock);
-        if (! juce::isPositiveAndBelow (index, tasks.size()))
-            return;
-        tasks.remove (index);
-    }
-    if (onTasksChanged)
-        onTasksChanged();
+    log.setDone (builder, builder.indexOf (id), done);
 }
 
-void TodoListNativeAudioProcessor::moveTask (int from, int to)
+void TodoListNativeAudioProcessor::Batch::removeTask (int index)
 {
-    {
-        const juce::ScopedLock sl (taskLock);
-        if (! juce::isPositiveAndBelow (from, tasks.size()) || ! juce::isPositiveAndBelow (to, tasks.size()))
-            return;
-        if (from == to)
-            return;
-        tasks.move (from, to);
-    }
-    if (onTasksChanged)
-        onTasksChanged();
+    log.remove (builder, index);
 }
 
-bool TodoListNativeAudioProcessor::getCollapsed() const noexcept
+void TodoListNativeAudioProcessor::Batch::removeTask (TaskId id)
 {
-    return collapsed;
+    log.remove (builder, builder.indexOf (id));
 }
 
-void TodoListNativeAudioProcessor::setCollapsed (bool shouldCollapse)
+void TodoListNativeAudioProcessor::Batch::moveTask (int from, int to)
+{
+    log.move (builder, from, to);
+}
+
+void TodoListNativeAudioProcessor::Batch::moveTask (TaskId id, int to)
+{
+    log.move (builder, builder.indexOf (id), to);
+}
+
+int TodoListNativeAudioProcessor::Batch::removeTasksIf (const std::function<bool (const TaskRef&)>& shouldRemove)
+{
+    return log.removeIf (builder, shouldRemove);
+}
+
+void TodoListNativeAudioProcessor::setStateFormat (StateFormat newFormat) noexcept
+{
+    stateFormat = newFormat;
+}
+
+TodoListNativeAudioProcessor::StateFormat TodoListNativeAudioProcessor::getStateFormat() const noexcept
+{
+    return stateFormat;
+}
+
+void TodoListNativeAudioProcessor::setAsyncStateLoading (bool shouldLoadAsync) noexcept
 {
-    collapsed = shouldCollapse;
-    if (onTasksChanged)
-        onTasksChanged();
+    asyncStateLoading = shouldLoadAsync;
+}
+
+bool TodoListNativeAudioProcessor::isStateLoadPending() const noexcept
+{
+    return pendingStateLoad.load() != nullptr;
+}
+
+// Must be called with writeLock held. Edits made while a load is pending apply on top
+// of it.
+std::shared_ptr<TodoListNativeAudioProcessor::PendingStateLoad> TodoListNativeAudioProcessor::takePendingStateLoad (TaskSnapshotBuilder& builder)
+{
+    auto load = pendingStateLoad.load();
+    if (load == nullptr)
+        return nullptr;
+
+    juce::Array<Task> loadedTasks;
+    bool loadedCollapsed = false;
+    TaskArchive::Ptr loadedArchive;
+
+    if (load->parsed)
+    {
+        builder.setTasks (load->tasks);
+        builder.setCollapsed (load->collapsed);
+        builder.setArchive (load->archive);
+        return load;
+    }
+
+    stateToTasks (load->bytes.getData(), load->bytes.getSize(), loadedTasks, loadedCollapsed, loadedArchive);
+    builder.setTasks (loadedTasks);
+    builder.setCollapsed (loadedCollapsed);
+    builder.setArchive (loadedArchive);
+    return load;
+}
+
+void TodoListNativeAudioProcessor::publishPendingStateLoad (const std::shared_ptr<PendingStateLoad>& load)
+{
+    {
+        const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+        if (pendingStateLoad.load() != load)
+            return;
+
+        TaskSnapshotBuilder builder (snapshot.load(), &idIndex, &textIndex);
+        builder.setTasks (load->tasks);
+        builder.setCollapsed (load->collapsed);
+        builder.setArchive (load->archive);
+        publishSnapshot (builder.build());
+        pendingStateLoad.store (nullptr);
+        queueChanges (builder.getChanges());
+    }
+
+    triggerAsyncUpdate();
 }
 
 void TodoListNativeAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    juce::Array<Task> copy;
-    bool collapsedCopy = false;
+    TODOLIST_TRACE_SCOPE ("getStateInformation");
+
+    if (const auto load = pendingStateLoad.load())
+    {
+        destData.replaceAll (load->bytes.getData(), load->bytes.getSize());
+        return;
+    }
+
+    const auto current = snapshot.load();
+    const auto format = stateFormat.load();
 
+    const PerfTrace::TimedScopedLock sl (stateCacheLock, "stateCacheLock wait");
+
+    if (cachedState.isEmpty() || cachedStateVersion != current.getVersion() || cachedStateFormat != format)
     {
-        const juce::ScopedLock sl (taskLock);
-        copy = tasks;
-        collapsedCopy = collapsed;
+        {
+            juce::MemoryOutputStream stream (cachedState, false);
+
+            if (format == StateFormat::binary)
+            {
+                tasksToBinary (current, stream);
+            }
+            else
+            {
+                tasksToJson (current, stream);
+                stream.writeByte (0);
+            }
+        }
+
+        cachedStateVersion = current.getVersion();
+        cachedStateFormat = format;
     }
 
-    const auto json = tasksToJson (copy, collapsedCopy);
-    juce::MemoryOutputStream stream (destData, false);
-    stream.writeString (json);
+    destData.replaceAll (cachedState.getData(), cachedState.getSize());
 }
 
 void TodoListNativeAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    const auto json = juce::String::fromUTF8 (static_cast<const char*> (data), sizeInBytes);
+    TODOLIST_TRACE_SCOPE ("setStateInformation");
+
+    if (sizeInBytes > 0)
+        stateFormat = isBinaryState (data, (size_t) sizeInBytes) ? StateFormat::binary : StateFormat::json;
+
+    if (asyncStateLoading)
+    {
+        auto load = std::make_shared<PendingStateLoad>();
+        load->bytes.replaceAll (data, (size_t) juce::jmax (0, sizeInBytes));
+
+        {
+            const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+            pendingStateLoad.store (load);
+            undoManager.clearUndoHistory();
+        }
+
+        stateLoadPool->addJob (new StateLoadJob (*this, std::move (load)), true);
+        return;
+    }
+
+    {
+        const PerfTrace::TimedScopedLock sl (writeLock, "writeLock wait");
+        pendingStateLoad.store (nullptr);
+    }
 
     juce::Array<Task> loadedTasks;
     bool loadedCollapsed = false;
-    jsonToTasks (json, loadedTasks, loadedCollapsed);
+    TaskArchive::Ptr loadedArchive;
+    stateToTasks (data, (size_t) juce::jmax (0, sizeInBytes), loadedTasks, loadedCollapsed, loadedArchive);
+
+    applyEdit ([&] (TaskSnapshotBuilder& builder)
+    {
+        builder.setTasks (loadedTasks);
+        builder.setCollapsed (loadedCollapsed);
+        builder.setArchive (loadedArchive);
+        undoManager.clearUndoHistory();
+        return true;
+    });
+}
+
+void TodoListNativeAudioProcessor::tasksToJson (const TaskSnapshot& source, juce::OutputStream& dest)
+{
+    TODOLIST_TRACE_SCOPE ("tasksToJson");
+
+    dest << '{' << juce::newLine;
+    dest.writeRepeatedByte (' ', 2);
+    dest << "\"collapsed\": " << (source.getCollapsed() ? "true" : "false") << ',' << juce::newLine;
+    dest.writeRepeatedByte (' ', 2);
+    dest << "\"tasks\": [";
+
+    const auto numTasks = source.size();
+    if (numTasks > 0)
+    {
+        dest << juce::newLine;
+
+        source.visitTasks (0, numTasks, [&] (int index, const TaskRef& task)
+        {
+            dest.writeRepeatedByte (' ', 4);
+            dest << '{' << juce::newLine;
+            dest.writeRepeatedByte (' ', 6);
+            dest << "\"text\": ";
+            writeJsonString (dest, task.text);
+            dest << ',' << juce::newLine;
+            dest.writeRepeatedByte (' ', 6);
+            dest << "\"done\": " << (task.done ? "true" : "false");
+
+            if (task.position != nullptr)
+            {
+                dest << ',' << juce::newLine;
+                dest.writeRepeatedByte (' ', 6);
+                dest << "\"position\": ";
+                writeJsonPosition (dest, *task.position);
+            }
+
+            dest << juce::newLine;
+            dest.writeRepeatedByte (' ', 4);
+            dest << '}';
+
+            if (index < numTasks - 1)
+                dest << ',';
+            dest << juce::newLine;
+        });
+
+        dest.writeRepeatedByte (' ', 2);
+    }
 
+    dest << ']';
+
+    const auto archive = source.getArchive();
+    if (! archive->isEmpty())
     {
-        const juce::ScopedLock sl (taskLock);
-        tasks = loadedTasks;
-        collapsed = loadedCollapsed;
+        juce::MemoryOutputStream archiveData;
+        archive->writeTo (archiveData);
+
+        dest << ',' << juce::newLine;
+        dest.writeRepeatedByte (' ', 2);
+        dest << "\"archive\": \"";
+        juce::Base64::convertToBase64 (dest, archiveData.getData(), archiveData.getDataSize());
+        dest << '"';
     }
 
-    if (onTasksChanged)
-        onTasksChanged();
+    dest << juce::newLine << '}';
+}
+
+void TodoListNativeAudioProcessor::jsonToTasks (const char* json, size_t numBytes, juce::Array<Task>& destTasks, bool& isCollapsed, TaskArchive::Ptr& destArchive)
+{
+    TODOLIST_TRACE_SCOPE ("jsonToTasks");
+
+    destTasks.clear();
+    isCollapsed = false;
+    destArchive = nullptr;
+
+    JsonStateReader reader (json, numBytes);
+    if (! reader.read (destTasks, isCollapsed, destArchive))
+    {
+        destTasks.clear();
+        isCollapsed = false;
+        destArchive = nullptr;
+    }
 }
 
-juce::String TodoListNativeAudioProcessor::tasksToJson (const juce::Array<Task>& source, bool isCollapsed)
+void TodoListNativeAudioProcessor::tasksToBinary (const TaskSnapshot& source, juce::OutputStream& dest)
 {
-    juce::DynamicObject::Ptr root (new juce::DynamicObject());
-    root->setProperty ("collapsed", isCollapsed);
+    TODOLIST_TRACE_SCOPE ("tasksToBinary");
+
+    const auto numTasks = source.size();
+    const auto archive = source.getArchive();
+
+    int numPositions = 0;
+    source.visitTasks (0, numTasks, [&] (int, const TaskRef& task) { numPositions += task.position != nullptr ? 1 : 0; });
+
+    const auto version = numPositions > 0 ? kBinaryStateVersion
+                                          : (archive->isEmpty() ? kBinaryStateVersionWithoutArchive : kBinaryStateVersionWithoutPositions);
+
+    dest.write (kBinaryStateMagic, sizeof (kBinaryStateMagic));
+    dest.writeInt (version);
+    dest.writeByte ((char) (source.getCollapsed() ? kCollapsedFlag : 0));
+    dest.writeCompressedInt (numTasks);
+
+    juce::uint8 doneBits = 0;
+    source.visitTasks (0, numTasks, [&] (int index, const TaskRef& task)
+    {
+        if (task.done)
+            doneBits |= (juce::uint8) (1u << (index % 8));
+
+        if (index % 8 == 7 || index == numTasks - 1)
+        {
+            dest.writeByte ((char) doneBits);
+            doneBits = 0;
+        }
+    });
 
-    juce::Array<juce::var> taskVars;
-    for (const auto& task : source)
+    source.visitTasks (0, numTasks, [&] (int, const TaskRef& task)
     {
-        juce::DynamicObject::Ptr item (new juce::DynamicObject());
-        item->setProperty ("text", task.text);
-        item->setProperty ("done", task.done);
-        taskVars.add (juce::var (item.get()));
+        dest.writeCompressedInt (task.numBytes);
+        dest.write (task.text.getAddress(), (size_t) task.numBytes);
+    });
+
+    if (version >= 2)
+        archive->writeTo (dest);
+
+    if (version >= 3)
+    {
+        dest.writeCompressedInt (numPositions);
+
+        source.visitTasks (0, numTasks, [&] (int index, const TaskRef& task)
+        {
+            if (task.position == nullptr)
+                return;
+
+            const auto& position = *task.position;
+            dest.writeCompressedInt (index);
+            dest.writeByte ((char) getPositionFields (position));
+
+            if (position.timeInSeconds)
+                dest.writeDouble (*position.timeInSeconds);
+            if (position.ppq)
+                dest.writeDouble (*position.ppq);
+            if (position.bar)
+                dest.writeInt64 (*position.bar);
+        });
     }
+}
 
-    root->setProperty ("tasks", juce::var (taskVars));
-    return juce::JSON::toString (juce::var (root.get()));
+void TodoListNativeAudioProcessor::stateToTasks (const void* data, size_t sizeInBytes, juce::Array<Task>& destTasks, bool& isCollapsed, TaskArchive::Ptr& destArchive)
+{
+    if (isBinaryState (data, sizeInBytes))
+        binaryToTasks (data, sizeInBytes, destTasks, isCollapsed, destArchive);
+    else
+        jsonToTasks (static_cast<const char*> (data), sizeInBytes, destTasks, isCollapsed, destArchive);
+}
+
+bool TodoListNativeAudioProcessor::isBinaryState (const void* data, size_t sizeInBytes) noexcept
+{
+    return sizeInBytes >= sizeof (kBinaryStateMagic)
+           && std::memcmp (data, kBinaryStateMagic, sizeof (kBinaryStateMagic)) == 0;
 }
 
-void TodoListNativeAudioProcessor::jsonToTasks (const juce::String& jsonText, juce::Array<Task>& destTasks, bool& isCollapsed)
+void TodoListNativeAudioProcessor::binaryToTasks (const void* data, size_t sizeInBytes, juce::Array<Task>& destTasks, bool& isCollapsed, TaskArchive::Ptr& destArchive)
 {
+    TODOLIST_TRACE_SCOPE ("binaryToTasks");
+
     destTasks.clear();
     isCollapsed = false;
+    destArchive = nullptr;
+
+    juce::MemoryInputStream stream (data, sizeInBytes, false);
+    stream.skipNextBytes ((juce::int64) sizeof (kBinaryStateMagic));
+
+    const auto version = stream.readInt();
+    if (version < 1 || version > kBinaryStateVersion)
+        return;
+
+    const auto flags = (juce::uint8) stream.readByte();
+    const auto numTasks = stream.readCompressedInt();
+    if (numTasks < 0 || (juce::int64) numTasks > stream.getNumBytesRemaining() * 8)
+        return;
+
+    const auto numDoneBytes = ((juce::int64) numTasks + 7) / 8;
+    if (numDoneBytes > stream.getNumBytesRemaining())
+        return;
 
-    const auto parsed = juce::JSON::parse (jsonText);
-    if (! parsed.isObject())
+    const auto* bytes = static_cast<const char*> (data);
+    const auto* doneBits = reinterpret_cast<const juce::uint8*> (bytes + stream.getPosition());
+    stream.skipNextBytes (numDoneBytes);
+
+    if ((juce::int64) numTasks > stream.getNumBytesRemaining())
         return;
 
-    if (auto* obj = parsed.getDynamicObject())
+    destTasks.ensureStorageAllocated (numTasks);
+
+    std::vector<int> loadedIndices (version >= 3 ? (size_t) numTasks : 0, -1);
+
+    for (int i = 0; i < numTasks; ++i)
     {
-        isCollapsed = static_cast<bool> (obj->getProperty ("collapsed"));
-        const auto tasksVar = obj->getProperty ("tasks");
-        if (tasksVar.isArray())
+        const auto numBytes = stream.readCompressedInt();
+        if (numBytes < 0 || numBytes > stream.getNumBytesRemaining())
         {
-            const auto* arr = tasksVar.getArray();
-            for (const auto& item : *arr)
-            {
-                if (auto* taskObj = item.getDynamicObject())
-                {
-                    Task t;
-                    t.text = taskObj->getProperty ("text").toString();
-                    t.done = static_cast<bool> (taskObj->getProperty ("done"));
-                    if (! t.text.isEmpty())
-                        destTasks.add (t);
-                }
-            }
+            destTasks.clear();
+            return;
+        }
+
+        Task t;
+        t.text = juce::String::fromUTF8 (bytes + stream.getPosition(), numBytes);
+        t.done = (doneBits[i / 8] & (1u << (i % 8))) != 0;
+        stream.skipNextBytes (numBytes);
+
+        if (t.text.isEmpty())
+            continue;
+
+        if (! loadedIndices.empty())
+            loadedIndices[(size_t) i] = destTasks.size();
+
+        destTasks.add (t);
+    }
+
+    isCollapsed = (flags & kCollapsedFlag) != 0;
+
+    if (version >= 2)
+        destArchive = TaskArchive::readFrom (stream);
+
+    if (version >= 3 && destArchive != nullptr)
+    {
+        const auto numPositions = stream.readCompressedInt();
+
+        for (int i = 0; i < numPositions && ! stream.isExhausted(); ++i)
+        {
+            const auto index = stream.readCompressedInt();
+            const auto fields = (juce::uint8) stream.readByte();
+
+            TaskPosition position;
+
+            if ((fields & kPositionHasTime) != 0)
+                position.timeInSeconds = stream.readDouble();
+            if ((fields & kPositionHasPpq) != 0)
+                position.ppq = stream.readDouble();
+            if ((fields & kPositionHasBar) != 0)
+                position.bar = stream.readInt64();
+
+            if (! juce::isPositiveAndBelow (index, numTasks) || position.isEmpty())
+                break;
+
+            if (const auto loadedIndex = loadedIndices[(size_t) index]; loadedIndex >= 0)
+                destTasks.getReference (loadedIndex).position = position;
         }
     }
 }
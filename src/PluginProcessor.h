@@ -1,14 +1,56 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "TaskSnapshot.h"
+#include "TaskEditLog.h"
+#include "PlayheadStampQueue.h"
 
-class TodoListNativeAudioProcessor final : public juce::AudioProcessor
+class TodoListNativeAudioProcessor final : public juce::AudioProcessor,
+                                           private juce::AsyncUpdater,
+                                           private juce::Timer
 {
 public:
-    struct Task
+    using Task = TodoTask;
+
+    class Listener
     {
-        juce::String text;
-        bool done = false;
+    public:
+        virtual ~Listener() = default;
+        virtual void tasksChanged (const TaskChangeSet& changes) = 0;
+    };
+
+    class Batch
+    {
+    public:
+        int getNumTasks() const noexcept;
+
+        // The TaskRef is only valid until the batch's next edit.
+        std::optional<TaskRef> getTask (int index) const noexcept;
+        int getTaskIndex (TaskId id) const;
+
+        TaskId addTask (juce::String text, std::optional<TaskPosition> position = std::nullopt);
+        void setTaskDone (int index, bool done);
+        void setTaskDone (TaskId id, bool done);
+        void removeTask (int index);
+        void removeTask (TaskId id);
+        void moveTask (int from, int to);
+        void moveTask (TaskId id, int to);
+        int removeTasksIf (const std::function<bool (const TaskRef&)>& shouldRemove);
+
+    private:
+        Batch (TaskSnapshotBuilder& builderToUse, TaskEditLog& logToUse) noexcept : builder (builderToUse), log (logToUse) {}
+
+        TaskSnapshotBuilder& builder;
+        TaskEditLog& log;
+
+        friend class TodoListNativeAudioProcessor;
+        JUCE_DECLARE_NON_COPYABLE (Batch)
+    };
+
+    enum class StateFormat
+    {
+        binary,
+        json
     };
 
     TodoListNativeAudioProcessor();
@@ -17,7 +59,9 @@ public:
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
+    bool supportsDoublePrecisionProcessing() const override;
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock (juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
     juce::AudioProcessorEditor* createEditor() override;
     bool hasEditor() const override;
 
@@ -36,24 +80,155 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
+    TaskSnapshot getSnapshot() const;
+    TaskStats getStats() const noexcept;
+
     int getNumTasks() const;
     Task getTask (int index) const;
-    void addTask (juce::String text);
+    TaskId addTask (juce::String text);
     void setTaskDone (int index, bool done);
     void removeTask (int index);
     void moveTask (int from, int to);
+    int getTaskIndex (TaskId id) const;
+    void setTaskDone (TaskId id, bool done);
+    void removeTask (TaskId id);
+    void moveTask (TaskId id, int to);
+
+    struct FoundTasks
+    {
+        juce::String query;
+        TaskSnapshot snapshot;
+        std::vector<TaskId> ids;
+        std::vector<int> indices;
+
+        size_t size() const noexcept    { return ids.size(); }
+    };
+
+    FoundTasks findTasks (const juce::String& query, const FoundTasks* previousSearch = nullptr) const;
+
     bool getCollapsed() const noexcept;
     void setCollapsed (bool shouldCollapse);
 
-    std::function<void()> onTasksChanged;
+    void applyBatch (const std::function<void (Batch&)>& edits);
+    int removeDoneTasks();
+    void setTasksDone (juce::Range<int> range, bool done);
+    void addTasks (const juce::StringArray& lines);
+
+    // Message thread only. The task is added once the next audio block stamps it.
+    void requestMarker (const juce::String& text);
+    std::optional<TaskPosition> getPlayheadPosition() const noexcept;
+    TaskId findTaskAtPlayhead() const;
+    void sortTasksByPosition();
+
+    int archiveDoneTasks();
+    void setArchiveThreshold (int maxDoneTasks) noexcept;
+    int getArchiveThreshold() const noexcept;
+    TaskArchive::Ptr getArchive() const;
+
+    bool undo();
+    bool redo();
+    bool canUndo() const;
+    bool canRedo() const;
+    void setUndoMemoryLimit (int maxBytes);
+    int getUndoMemoryLimit() const noexcept;
+
+    void setStateFormat (StateFormat newFormat) noexcept;
+    StateFormat getStateFormat() const noexcept;
+    void setAsyncStateLoading (bool shouldLoadAsync) noexcept;
+    bool isStateLoadPending() const noexcept;
+
+    void addListener (Listener* listener);
+    void removeListener (Listener* listener);
 
 private:
-    juce::Array<Task> tasks;
-    bool collapsed = false;
-    mutable juce::CriticalSection taskLock;
+    struct MarkerRequest
+    {
+        juce::uint32 number = 0;
+        juce::String text;
+        juce::uint32 requestedAt = 0;
+    };
+    AtomicTaskSnapshot snapshot;
+    juce::CriticalSection writeLock;
+    TaskIdIndex idIndex;
+    TaskTextIndex textIndex;
+
+    std::atomic<juce::uint32> statsSequence { 0 };
+    std::atomic<int> statsTotal { 0 }, statsDone { 0 };
+    std::atomic<juce::int64> statsTextBytes { 0 };
+    std::atomic<juce::uint64> statsOldestOpen { 0 };
+    std::atomic<int> statsArchived { 0 };
+    std::atomic<int> archiveThreshold { 200 };
+
+    std::atomic<StateFormat> stateFormat { StateFormat::binary };
+
+    juce::CriticalSection stateCacheLock;
+    juce::MemoryBlock cachedState;
+    juce::uint64 cachedStateVersion = 0;
+    StateFormat cachedStateFormat = StateFormat::binary;
+
+    struct PendingStateLoad
+    {
+        juce::MemoryBlock bytes;
+        juce::Array<Task> tasks;
+        bool collapsed = false;
+        TaskArchive::Ptr archive;
+        std::atomic<bool> parsed { false };
+    };
+
+    std::atomic<bool> asyncStateLoading { true };
+    LockFreeSharedPtr<PendingStateLoad> pendingStateLoad;
+    juce::SharedResourcePointer<juce::ThreadPool> stateLoadPool;
+
+    class StateLoadJob;
+
+    class EditAction;
+
+    juce::UndoManager undoManager;
+    int undoMemoryLimit = 0;
+
+    // Owned by the message thread; only the latest request number goes to the audio thread.
+    std::vector<MarkerRequest> markerRequests;
+    juce::uint32 lastMarkerRequest = 0;
+    std::atomic<juce::uint32> markersRequested { 0 };
+    juce::uint32 markersStamped = 0;
+    PlayheadStampQueue markerStamps;
+
+    std::atomic<juce::uint32> playheadSequence { 0 };
+    std::atomic<juce::uint8> playheadFields { 0 };
+    std::atomic<double> playheadTime { 0.0 }, playheadPpq { 0.0 };
+    std::atomic<juce::int64> playheadBar { 0 };
+
+    juce::ListenerList<Listener> listeners;
+    juce::CriticalSection changeLock;
+    TaskChangeSet pendingChanges;
+
+    template <typename EditFunction>
+    bool applyEdit (EditFunction&& edit);
+
+    template <typename SampleType>
+    void passThrough (juce::AudioBuffer<SampleType>& buffer) noexcept;
+
+    TaskPosition readPlayhead() noexcept;
+    void publishPlayhead (const TaskPosition& position) noexcept;
+    void stampMarkers (const TaskPosition& position) noexcept;
+    void addMarkedTasks();
+    void timerCallback() override;
+
+    void publishSnapshot (const TaskSnapshot& newSnapshot);
+    void archiveExcessDoneTasks();
+    void addToUndoHistory (TaskEditLog&& log, bool startsNewStep);
+    void queueChanges (const TaskChangeSet& changes);
+    void handleAsyncUpdate() override;
+
+    std::shared_ptr<PendingStateLoad> takePendingStateLoad (TaskSnapshotBuilder& builder);
+    void publishPendingStateLoad (const std::shared_ptr<PendingStateLoad>& load);
 
-    static juce::String tasksToJson (const juce::Array<Task>& source, bool isCollapsed);
-    static void jsonToTasks (const juce::String& jsonText, juce::Array<Task>& destTasks, bool& isCollapsed);
+    static void tasksToJson (const TaskSnapshot& source, juce::OutputStream& dest);
+    static void jsonToTasks (const char* json, size_t numBytes, juce::Array<Task>& destTasks, bool& isCollapsed, TaskArchive::Ptr& destArchive);
+    static void tasksToBinary (const TaskSnapshot& source, juce::OutputStream& dest);
+    static bool isBinaryState (const void* data, size_t sizeInBytes) noexcept;
+    static void binaryToTasks (const void* data, size_t sizeInBytes, juce::Array<Task>& destTasks, bool& isCollapsed, TaskArchive::Ptr& destArchive);
+    static void stateToTasks (const void* data, size_t sizeInBytes, juce::Array<Task>& destTasks, bool& isCollapsed, TaskArchive::Ptr& destArchive);
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TodoListNativeAudioProcessor)
 };
@@ -0,0 +1,218 @@
+#include "RealtimeGuard.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+namespace
+{
+constexpr int kMaxReports = 32;
+constexpr int kMaxRealtimeThreads = 16;
+
+// Threads are found by ID, as PerfTrace finds its buffers. Only the owning thread touches
+// a slot's checking flag, which stops the guard catching what it does about a violation.
+struct RealtimeSlot
+{
+    std::atomic<juce::Thread::ThreadID> owner { nullptr };
+    std::atomic<bool> checking { false };
+};
+
+std::array<RealtimeSlot, kMaxRealtimeThreads> realtimeSlots;
+
+RealtimeSlot* findSlot (juce::Thread::ThreadID thread) noexcept
+{
+    for (auto& slot : realtimeSlots)
+        if (slot.owner.load (std::memory_order_relaxed) == thread)
+            return &slot;
+
+    return nullptr;
+}
+
+std::atomic<RealtimeGuard::Response> response { RealtimeGuard::Response::record };
+std::atomic<int> numViolations { 0 };
+std::array<std::atomic<int>, kMaxReports> reportedViolations {};
+std::array<std::atomic<const char*>, kMaxReports> reportedWhat {};
+} // namespace
+
+void RealtimeGuard::setResponse (Response newResponse) noexcept
+{
+    response = newResponse;
+}
+
+bool RealtimeGuard::isRealtimeThread() noexcept
+{
+    return findSlot (juce::Thread::getCurrentThreadId()) != nullptr;
+}
+
+void RealtimeGuard::check (Violation violation, const char* what) noexcept
+{
+    auto* slot = findSlot (juce::Thread::getCurrentThreadId());
+
+    if (slot == nullptr || slot->checking.load (std::memory_order_relaxed))
+        return;
+
+    slot->checking.store (true, std::memory_order_relaxed);
+
+    const auto index = numViolations.fetch_add (1);
+
+    if (index < kMaxReports)
+    {
+        reportedViolations[(size_t) index].store ((int) violation, std::memory_order_relaxed);
+        reportedWhat[(size_t) index].store (what, std::memory_order_release);
+    }
+
+    if (response == Response::trap)
+    {
+        std::fprintf (stderr, "real-time violation: %s (%s)\n", getName (violation), what);
+        std::abort();
+    }
+
+    slot->checking.store (false, std::memory_order_relaxed);
+}
+
+int RealtimeGuard::getNumViolations() noexcept
+{
+    return numViolations.load();
+}
+
+std::vector<RealtimeGuard::Report> RealtimeGuard::getReports()
+{
+    std::vector<Report> reports;
+
+    for (int i = 0; i < juce::jmin (kMaxReports, getNumViolations()); ++i)
+        if (const auto* what = reportedWhat[(size_t) i].load (std::memory_order_acquire))
+            reports.push_back ({ (Violation) reportedViolations[(size_t) i].load (std::memory_order_relaxed), what });
+
+    return reports;
+}
+
+void RealtimeGuard::clearViolations() noexcept
+{
+    for (auto& what : reportedWhat)
+        what = nullptr;
+
+    numViolations = 0;
+}
+
+const char* RealtimeGuard::getName (Violation violation) noexcept
+{
+    switch (violation)
+    {
+        case Violation::allocation:     return "allocation";
+        case Violation::deallocation:   return "deallocation";
+        case Violation::lock:           return "lock";
+        case Violation::systemCall:     return "system call";
+    }
+
+    return "unknown";
+}
+
+// A nested section leaves the slot to the outermost one.
+RealtimeGuard::ScopedRealtimeSection::ScopedRealtimeSection() noexcept
+{
+    const auto thread = juce::Thread::getCurrentThreadId();
+
+    if (findSlot (thread) != nullptr)
+        return;
+
+    for (int i = 0; i < kMaxRealtimeThreads; ++i)
+    {
+        juce::Thread::ThreadID expected = nullptr;
+
+        if (realtimeSlots[(size_t) i].owner.compare_exchange_strong (expected, thread))
+        {
+            slotIndex = i;
+            return;
+        }
+    }
+}
+
+RealtimeGuard::ScopedRealtimeSection::~ScopedRealtimeSection()
+{
+    if (slotIndex >= 0)
+        realtimeSlots[(size_t) slotIndex].owner.store (nullptr);
+}
+
+//==============================================================================
+#if TODOLIST_REALTIME_GUARD
+
+namespace
+{
+void* allocate (size_t size) noexcept
+{
+    RealtimeGuard::check (RealtimeGuard::Violation::allocation, "operator new");
+    return std::malloc (size > 0 ? size : 1);
+}
+
+// The block malloc returned is kept just before the aligned one, so it can be freed.
+void* allocateAligned (size_t size, std::align_val_t alignment) noexcept
+{
+    RealtimeGuard::check (RealtimeGuard::Violation::allocation, "operator new");
+
+    const auto align = juce::jmax ((size_t) alignment, sizeof (void*));
+
+    if (size > std::numeric_limits<size_t>::max() - align)
+        return nullptr;
+
+    auto* block = std::malloc (size + align);
+
+    if (block == nullptr)
+        return nullptr;
+
+    const auto address = (reinterpret_cast<std::uintptr_t> (block) + align) & ~(std::uintptr_t) (align - 1);
+    auto* aligned = reinterpret_cast<void**> (address);
+    aligned[-1] = block;
+    return aligned;
+}
+
+void release (void* block) noexcept
+{
+    if (block != nullptr)
+        RealtimeGuard::check (RealtimeGuard::Violation::deallocation, "operator delete");
+
+    std::free (block);
+}
+
+void releaseAligned (void* block) noexcept
+{
+    if (block == nullptr)
+        return;
+
+    RealtimeGuard::check (RealtimeGuard::Violation::deallocation, "operator delete");
+    std::free (static_cast<void**> (block)[-1]);
+}
+
+template <typename Allocation>
+void* allocateOrThrow (Allocation&& allocation)
+{
+    if (auto* block = allocation())
+        return block;
+
+    throw std::bad_alloc();
+}
+} // namespace
+
+void* operator new (size_t size)                                                    { return allocateOrThrow ([&] { return allocate (size); }); }
+void* operator new[] (size_t size)                                                  { return allocateOrThrow ([&] { return allocate (size); }); }
+void* operator new (size_t size, const std::nothrow_t&) noexcept                    { return allocate (size); }
+void* operator new[] (size_t size, const std::nothrow_t&) noexcept                  { return allocate (size); }
+void* operator new (size_t size, std::align_val_t alignment)                        { return allocateOrThrow ([&] { return allocateAligned (size, alignment); }); }
+void* operator new[] (size_t size, std::align_val_t alignment)                      { return allocateOrThrow ([&] { return allocateAligned (size, alignment); }); }
+void* operator new (size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept    { return allocateAligned (size, alignment); }
+void* operator new[] (size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept  { return allocateAligned (size, alignment); }
+
+void operator delete (void* block) noexcept                                         { release (block); }
+void operator delete[] (void* block) noexcept                                       { release (block); }
+void operator delete (void* block, size_t) noexcept                                 { release (block); }
+void operator delete[] (void* block, size_t) noexcept                               { release (block); }
+void operator delete (void* block, const std::nothrow_t&) noexcept                  { release (block); }
+void operator delete[] (void* block, const std::nothrow_t&) noexcept                { release (block); }
+void operator delete (void* block, std::align_val_t) noexcept                       { releaseAligned (block); }
+void operator delete[] (void* block, std::align_val_t) noexcept                     { releaseAligned (block); }
+void operator delete (void* block, size_t, std::align_val_t) noexcept               { releaseAligned (block); }
+void operator delete[] (void* block, size_t, std::align_val_t) noexcept             { releaseAligned (block); }
+void operator delete (void* block, std::align_val_t, const std::nothrow_t&) noexcept    { releaseAligned (block); }
+void operator delete[] (void* block, std::align_val_t, const std::nothrow_t&) noexcept  { releaseAligned (block); }
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#ifndef TODOLIST_REALTIME_GUARD
+ #define TODOLIST_REALTIME_GUARD 0
+#endif
+
+// Only active with TODOLIST_REALTIME_GUARD=1. Locks and system calls inside JUCE are
+// only caught where the offline check interposes them.
+class RealtimeGuard
+{
+public:
+    enum class Violation
+    {
+        allocation,
+        deallocation,
+        lock,
+        systemCall
+    };
+
+    enum class Response
+    {
+        record,
+        trap
+    };
+
+    struct Report
+    {
+        Violation violation = Violation::allocation;
+        const char* what = nullptr;
+    };
+
+    static void setResponse (Response newResponse) noexcept;
+
+    static bool isRealtimeThread() noexcept;
+    static void check (Violation violation, const char* what) noexcept;
+
+    static int getNumViolations() noexcept;
+    static std::vector<Report> getReports();
+    static void clearViolations() noexcept;
+
+    static const char* getName (Violation violation) noexcept;
+
+    class ScopedRealtimeSection
+    {
+    public:
+        ScopedRealtimeSection() noexcept;
+        ~ScopedRealtimeSection();
+
+    private:
+        int slotIndex = -1;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedRealtimeSection)
+    };
+
+private:
+    RealtimeGuard() = delete;
+};
+
+#if TODOLIST_REALTIME_GUARD
+ #define TODOLIST_REALTIME_SECTION const RealtimeGuard::ScopedRealtimeSection JUCE_JOIN_MACRO (realtimeSection_, __LINE__)
+#else
+ #define TODOLIST_REALTIME_SECTION
+#endif
@@ -0,0 +1,144 @@
+#include "TaskArchive.h"
+
+size_t TaskArchive::getCompressedSize() const noexcept
+{
+    size_t total = 0;
+
+    for (const auto& block : blocks)
+        total += block->gzipData.getSize();
+
+    return total;
+}
+
+TaskArchive::Ptr TaskArchive::withTasks (const juce::StringArray& texts) const
+{
+    auto archive = std::make_shared<TaskArchive> (*this);
+
+    if (texts.isEmpty())
+        return archive;
+
+    archive->blocks.push_back (compress (texts));
+    archive->numTasks += texts.size();
+
+    auto& newBlocks = archive->blocks;
+
+    while (newBlocks.size() > 1 && newBlocks.back()->numTasks >= newBlocks[newBlocks.size() - 2]->numTasks)
+    {
+        juce::StringArray merged;
+
+        if (! decompress (*newBlocks[newBlocks.size() - 2], merged) || ! decompress (*newBlocks.back(), merged))
+            break;
+
+        newBlocks.pop_back();
+        newBlocks.back() = compress (merged);
+    }
+
+    return archive;
+}
+
+juce::StringArray TaskArchive::loadTasks() const
+{
+    juce::StringArray texts;
+    texts.ensureStorageAllocated (numTasks);
+
+    for (const auto& block : blocks)
+    {
+        const auto numLoaded = texts.size();
+
+        if (! decompress (*block, texts))
+        {
+            jassertfalse;
+            texts.removeRange (numLoaded, texts.size() - numLoaded);
+        }
+    }
+
+    return texts;
+}
+
+void TaskArchive::writeTo (juce::OutputStream& dest) const
+{
+    dest.writeCompressedInt ((int) blocks.size());
+
+    for (const auto& block : blocks)
+    {
+        dest.writeCompressedInt (block->numTasks);
+        dest.writeCompressedInt ((int) block->gzipData.getSize());
+        dest.write (block->gzipData.getData(), block->gzipData.getSize());
+    }
+}
+
+TaskArchive::Ptr TaskArchive::readFrom (juce::InputStream& source)
+{
+    auto archive = std::make_shared<TaskArchive>();
+    const auto numBlocks = source.readCompressedInt();
+
+    if (numBlocks < 0 || numBlocks > source.getNumBytesRemaining())
+        return nullptr;
+
+    for (int i = 0; i < numBlocks; ++i)
+    {
+        auto block = std::make_shared<Block>();
+        block->numTasks = source.readCompressedInt();
+        const auto numBytes = source.readCompressedInt();
+
+        if (block->numTasks <= 0 || numBytes < 0 || numBytes > source.getNumBytesRemaining())
+            return nullptr;
+
+        // Deflate expands at most 1032:1 and every task takes at least one byte.
+        if ((juce::int64) block->numTasks > (juce::int64) numBytes * 1032
+            || (juce::int64) archive->numTasks + block->numTasks > std::numeric_limits<int>::max())
+            return nullptr;
+
+        source.readIntoMemoryBlock (block->gzipData, numBytes);
+        archive->numTasks += block->numTasks;
+        archive->blocks.push_back (std::move (block));
+    }
+
+    return archive;
+}
+
+// Each block holds, once decompressed, a compressed-int byte length followed by that many
+// UTF-8 bytes for every task in it.
+std::shared_ptr<const TaskArchive::Block> TaskArchive::compress (const juce::StringArray& texts)
+{
+    auto block = std::make_shared<Block>();
+    block->numTasks = texts.size();
+
+    {
+        juce::MemoryOutputStream compressed (block->gzipData, false);
+        juce::GZIPCompressorOutputStream gzip (compressed, 9, juce::GZIPCompressorOutputStream::windowBitsGZIP);
+
+        for (const auto& text : texts)
+        {
+            const auto numBytes = text.getNumBytesAsUTF8();
+            gzip.writeCompressedInt ((int) numBytes);
+            gzip.write (text.toRawUTF8(), numBytes);
+        }
+    }
+
+    return block;
+}
+
+bool TaskArchive::decompress (const Block& block, juce::StringArray& destTexts)
+{
+    juce::MemoryInputStream compressed (block.gzipData, false);
+    juce::GZIPDecompressorInputStream gzip (&compressed, false, juce::GZIPDecompressorInputStream::gzipFormat);
+
+    juce::MemoryBlock data;
+    gzip.readIntoMemoryBlock (data);
+
+    juce::MemoryInputStream stream (data, false);
+    const auto* bytes = static_cast<const char*> (data.getData());
+
+    for (int i = 0; i < block.numTasks; ++i)
+    {
+        const auto numBytes = stream.readCompressedInt();
+        if (numBytes < 0 || numBytes > stream.getNumBytesRemaining())
+            return false;
+
+        destTexts.add (juce::String::fromUTF8 (bytes + stream.getPosition(), numBytes));
+        stream.skipNextBytes (numBytes);
+    }
+
+    return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Immutable: appending returns a new archive sharing the old one's compressed blocks.
+class TaskArchive
+{
+public:
+    using Ptr = std::shared_ptr<const TaskArchive>;
+
+    TaskArchive() = default;
+
+    int size() const noexcept           { return numTasks; }
+    bool isEmpty() const noexcept       { return numTasks == 0; }
+    size_t getCompressedSize() const noexcept;
+
+    Ptr withTasks (const juce::StringArray& texts) const;
+    juce::StringArray loadTasks() const;
+
+    void writeTo (juce::OutputStream& dest) const;
+    static Ptr readFrom (juce::InputStream& source);
+
+private:
+    struct Block
+    {
+        int numTasks = 0;
+        juce::MemoryBlock gzipData;
+    };
+
+    std::vector<std::shared_ptr<const Block>> blocks;
+    int numTasks = 0;
+
+    static std::shared_ptr<const Block> compress (const juce::StringArray& texts);
+    static bool decompress (const Block& block, juce::StringArray& destTexts);
+
+    JUCE_LEAK_DETECTOR (TaskArchive)
+};
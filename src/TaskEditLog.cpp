@@ -0,0 +1,124 @@
+#include "TaskEditLog.h"
+
+TaskId TaskEditLog::insert (TaskSnapshotBuilder& builder, int index, TodoTask task)
+{
+    index = juce::jlimit (0, builder.size(), index);
+    const auto id = builder.insert (index, task);
+    task.id = id;
+    add ({ Edit::Type::insert, index, 0, false, std::move (task) });
+    return id;
+}
+
+void TaskEditLog::remove (TaskSnapshotBuilder& builder, int index)
+{
+    const auto task = builder.getTask (index);
+    if (! task.has_value())
+        return;
+
+    add ({ Edit::Type::remove, index, 0, false, task->toTask() });
+    builder.remove (index);
+}
+
+void TaskEditLog::move (TaskSnapshotBuilder& builder, int from, int to)
+{
+    if (! juce::isPositiveAndBelow (from, builder.size()) || ! juce::isPositiveAndBelow (to, builder.size()) || from == to)
+        return;
+
+    builder.move (from, to);
+    add ({ Edit::Type::move, from, to });
+}
+
+void TaskEditLog::setDone (TaskSnapshotBuilder& builder, int index, bool done)
+{
+    const auto task = builder.getTask (index);
+    if (! task.has_value() || task->done == done)
+        return;
+
+    builder.setDone (index, done);
+    add ({ Edit::Type::setDone, index, 0, done });
+}
+
+int TaskEditLog::removeIf (TaskSnapshotBuilder& builder, const std::function<bool (const TaskRef&)>& shouldRemove)
+{
+    return builder.removeIf (recordingRemovals (shouldRemove));
+}
+
+int TaskEditLog::archiveIf (TaskSnapshotBuilder& builder, const std::function<bool (const TaskRef&)>& shouldArchive)
+{
+    const auto archiveBefore = builder.getArchive();
+    const auto numArchived = builder.archiveIf (recordingRemovals (shouldArchive));
+
+    if (numArchived > 0)
+    {
+        Edit edit { Edit::Type::setArchive };
+        edit.archiveBefore = archiveBefore;
+        edit.archiveAfter = builder.getArchive();
+        add (std::move (edit));
+    }
+
+    return numArchived;
+}
+
+// The predicate sees every task once, in list order, so a removal is recorded at the index
+// the task has once the removals before it have been made.
+std::function<bool (const TaskRef&)> TaskEditLog::recordingRemovals (const std::function<bool (const TaskRef&)>& shouldRemove)
+{
+    return [this, &shouldRemove, position = 0] (const TaskRef& task) mutable
+    {
+        if (! shouldRemove (task))
+        {
+            ++position;
+            return false;
+        }
+
+        add ({ Edit::Type::remove, position, 0, false, task.toTask() });
+        return true;
+    };
+}
+
+void TaskEditLog::redo (TaskSnapshotBuilder& builder) const
+{
+    for (const auto& edit : edits)
+        edit.applyTo (builder);
+}
+
+void TaskEditLog::undo (TaskSnapshotBuilder& builder) const
+{
+    for (auto it = edits.rbegin(); it != edits.rend(); ++it)
+        it->inverted().applyTo (builder);
+}
+
+void TaskEditLog::add (Edit edit)
+{
+    sizeInBytes += sizeof (Edit) + edit.task.text.getNumBytesAsUTF8();
+    edits.push_back (std::move (edit));
+}
+
+//==============================================================================
+TaskEditLog::Edit TaskEditLog::Edit::inverted() const
+{
+    auto inverse = *this;
+
+    switch (type)
+    {
+        case Type::insert:          inverse.type = Type::remove; break;
+        case Type::remove:          inverse.type = Type::insert; break;
+        case Type::move:            std::swap (inverse.index, inverse.destination); break;
+        case Type::setDone:         inverse.value = ! value; break;
+        case Type::setArchive:      std::swap (inverse.archiveBefore, inverse.archiveAfter); break;
+    }
+
+    return inverse;
+}
+
+void TaskEditLog::Edit::applyTo (TaskSnapshotBuilder& builder) const
+{
+    switch (type)
+    {
+        case Type::insert:          builder.insert (index, task); break;
+        case Type::remove:          builder.remove (index); break;
+        case Type::move:            builder.move (index, destination); break;
+        case Type::setDone:         builder.setDone (index, value); break;
+        case Type::setArchive:      builder.setArchive (archiveAfter); break;
+    }
+}
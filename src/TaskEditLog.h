@@ -0,0 +1,55 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "TaskSnapshot.h"
+
+// Replaying assumes the list is exactly as it was when the edits were recorded.
+class TaskEditLog
+{
+public:
+    TaskEditLog() = default;
+
+    bool isEmpty() const noexcept               { return edits.empty(); }
+    size_t getSizeInBytes() const noexcept      { return sizeInBytes; }
+
+    TaskId insert (TaskSnapshotBuilder& builder, int index, TodoTask task);
+    void remove (TaskSnapshotBuilder& builder, int index);
+    void move (TaskSnapshotBuilder& builder, int from, int to);
+    void setDone (TaskSnapshotBuilder& builder, int index, bool done);
+    int removeIf (TaskSnapshotBuilder& builder, const std::function<bool (const TaskRef&)>& shouldRemove);
+    int archiveIf (TaskSnapshotBuilder& builder, const std::function<bool (const TaskRef&)>& shouldArchive);
+
+    void redo (TaskSnapshotBuilder& builder) const;
+    void undo (TaskSnapshotBuilder& builder) const;
+
+private:
+    struct Edit
+    {
+        enum class Type
+        {
+            insert,
+            remove,
+            move,
+            setDone,
+            setArchive
+        };
+
+        Type type = Type::insert;
+        int index = 0;
+        int destination = 0;
+        bool value = false;
+        TodoTask task {};
+        TaskArchive::Ptr archiveBefore {}, archiveAfter {};
+
+        Edit inverted() const;
+        void applyTo (TaskSnapshotBuilder& builder) const;
+    };
+
+    std::vector<Edit> edits;
+    size_t sizeInBytes = 0;
+
+    void add (Edit edit);
+    std::function<bool (const TaskRef&)> recordingRemovals (const std::function<bool (const TaskRef&)>& shouldRemove);
+
+    JUCE_LEAK_DETECTOR (TaskEditLog)
+};
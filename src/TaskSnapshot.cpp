@@ -0,0 +1,1251 @@
+#include "TaskSnapshot.h"
+
+namespace
+{
+constexpr size_t kMaxLeafSize = 64;
+constexpr size_t kFillLeafSize = 48;
+constexpr size_t kMergeLeafSize = kMaxLeafSize / 4;
+constexpr size_t kMaxChildren = 32;
+constexpr size_t kFillChildren = 24;
+constexpr size_t kMergeChildren = kMaxChildren / 4;
+constexpr juce::uint64 kLabelSpacing = (juce::uint64) 1 << 32;
+constexpr int kMaxTrackedChanges = 256;
+
+juce::uint64 createEditToken() noexcept
+{
+    static std::atomic<juce::uint64> nextToken { 1 };
+    return nextToken++;
+}
+
+TaskRef refTo (const TodoTask& task) noexcept
+{
+    return { task.text.getCharPointer(), (int) task.text.getNumBytesAsUTF8(), task.done, task.id,
+             task.position.has_value() ? &*task.position : nullptr };
+}
+
+/*  The tasks of one leaf, stored column by column. Every task's text is copied into a single
+    arena with a null terminator so TaskRefs can point straight at it, and the done flags
+    share one 64-bit mask. Removing a task only forgets its text; the arena is compacted once
+    more of it is dead than alive. Few tasks carry a playhead position, so those are kept
+    apart, keyed by ID.
+*/
+class LeafTaskStore
+{
+public:
+    size_t size() const noexcept                { return ids.size(); }
+    bool empty() const noexcept                 { return ids.empty(); }
+    TaskId getId (size_t index) const noexcept  { return ids[index]; }
+    bool isDone (size_t index) const noexcept   { return ((doneBits >> index) & 1) != 0; }
+
+    TaskRef get (size_t index) const noexcept
+    {
+        const auto& slot = slots[index];
+        return { juce::CharPointer_UTF8 (arena.data() + slot.offset), (int) slot.numBytes, isDone (index), ids[index],
+                 findPosition (ids[index]) };
+    }
+
+    void insert (size_t index, const TaskRef& task)
+    {
+        jassert (size() < kMaxLeafSize);
+
+        const auto below = getBitsBelow (index);
+        slots.insert (slots.begin() + (std::ptrdiff_t) index, appendText (task));
+        ids.insert (ids.begin() + (std::ptrdiff_t) index, task.id);
+        doneBits = (doneBits & below) | ((doneBits & ~below) << 1) | ((juce::uint64) task.done << index);
+
+        if (task.position != nullptr)
+            positions.push_back ({ task.id, *task.position });
+    }
+
+    void add (const TaskRef& task)
+    {
+        insert (size(), task);
+    }
+
+    void erase (size_t index)
+    {
+        const auto below = getBitsBelow (index);
+        deadBytes += slots[index].numBytes + 1;
+        forgetPosition (ids[index]);
+        slots.erase (slots.begin() + (std::ptrdiff_t) index);
+        ids.erase (ids.begin() + (std::ptrdiff_t) index);
+        doneBits = (doneBits & below) | ((doneBits >> 1) & ~below);
+        compactIfWasteful();
+    }
+
+    void reserve (size_t numTasks, size_t numTextBytes)
+    {
+        arena.reserve (arena.size() + numTextBytes + numTasks);
+        slots.reserve (numTasks);
+        ids.reserve (numTasks);
+    }
+
+    void moveTailTo (LeafTaskStore& dest, size_t index)
+    {
+        size_t numTextBytes = 0;
+        for (auto i = index; i < size(); ++i)
+            numTextBytes += slots[i].numBytes;
+
+        dest.reserve (dest.size() + size() - index, numTextBytes);
+
+        for (auto i = index; i < size(); ++i)
+        {
+            dest.add (get (i));
+            forgetPosition (ids[i]);
+        }
+
+        slots.resize (index);
+        ids.resize (index);
+        doneBits &= getBitsBelow (index);
+        compact();
+    }
+
+    void setDone (size_t index, bool done) noexcept
+    {
+        const auto bit = (juce::uint64) 1 << index;
+        doneBits = done ? (doneBits | bit) : (doneBits & ~bit);
+    }
+
+private:
+    struct TextSlot
+    {
+        juce::uint32 offset = 0;
+        juce::uint32 numBytes = 0;
+    };
+
+    std::vector<char> arena;
+    std::vector<TextSlot> slots;
+    std::vector<TaskId> ids;
+    juce::uint64 doneBits = 0;
+    size_t deadBytes = 0;
+    std::vector<std::pair<TaskId, TaskPosition>> positions;
+
+    const TaskPosition* findPosition (TaskId id) const noexcept
+    {
+        for (const auto& entry : positions)
+            if (entry.first == id)
+                return &entry.second;
+
+        return nullptr;
+    }
+
+    void forgetPosition (TaskId id)
+    {
+        positions.erase (std::remove_if (positions.begin(), positions.end(), [id] (const auto& entry) { return entry.first == id; }),
+                         positions.end());
+    }
+
+    static juce::uint64 getBitsBelow (size_t index) noexcept
+    {
+        return index >= 64 ? ~(juce::uint64) 0 : ((juce::uint64) 1 << index) - 1;
+    }
+
+    TextSlot appendText (const TaskRef& task)
+    {
+        const TextSlot slot { (juce::uint32) arena.size(), (juce::uint32) task.numBytes };
+        arena.insert (arena.end(), task.text.getAddress(), task.text.getAddress() + task.numBytes);
+        arena.push_back (0);
+        return slot;
+    }
+
+    void compactIfWasteful()
+    {
+        if (deadBytes * 2 > arena.size())
+            compact();
+    }
+
+    void compact()
+    {
+        size_t liveBytes = 0;
+        for (const auto& slot : slots)
+            liveBytes += slot.numBytes + 1;
+
+        std::vector<char> compacted;
+        compacted.reserve (liveBytes);
+
+        for (auto& slot : slots)
+        {
+            const auto* start = arena.data() + slot.offset;
+            slot.offset = (juce::uint32) compacted.size();
+            compacted.insert (compacted.end(), start, start + slot.numBytes + 1);
+        }
+
+        arena = std::move (compacted);
+        deadBytes = 0;
+    }
+};
+
+TaskId getOlderTask (TaskId a, TaskId b) noexcept
+{
+    if (a == TaskId::invalid)
+        return b;
+
+    if (b == TaskId::invalid)
+        return a;
+
+    return juce::jmin (a, b);
+}
+
+template <typename Node>
+void addToLeafSummary (Node& leaf, const TaskRef& task)
+{
+    ++leaf.count;
+    leaf.textBytes += task.numBytes;
+
+    if (task.done)
+        ++leaf.doneCount;
+    else
+        leaf.oldestOpen = getOlderTask (leaf.oldestOpen, task.id);
+}
+
+template <typename Node>
+void refreshOldestOpen (Node& leaf) noexcept
+{
+    leaf.oldestOpen = TaskId::invalid;
+
+    for (size_t i = 0; i < leaf.tasks.size(); ++i)
+        if (! leaf.tasks.isDone (i))
+            leaf.oldestOpen = getOlderTask (leaf.oldestOpen, leaf.tasks.getId (i));
+}
+
+template <typename Node>
+void summarise (Node& node)
+{
+    node.count = 0;
+    node.doneCount = 0;
+    node.textBytes = 0;
+    node.oldestOpen = TaskId::invalid;
+
+    if (node.isLeaf)
+    {
+        for (size_t i = 0; i < node.tasks.size(); ++i)
+            addToLeafSummary (node, node.tasks.get (i));
+
+        return;
+    }
+
+    for (const auto& child : node.children)
+    {
+        node.count += child->count;
+        node.doneCount += child->doneCount;
+        node.textBytes += child->textBytes;
+        node.oldestOpen = getOlderTask (node.oldestOpen, child->oldestOpen);
+    }
+}
+
+template <typename Node>
+size_t getFill (const Node& node) noexcept
+{
+    return node.isLeaf ? node.tasks.size() : node.children.size();
+}
+
+template <typename Node>
+const Node* findLeaf (const Node* node, int& index) noexcept
+{
+    while (! node->isLeaf)
+    {
+        size_t i = 0;
+        while (index >= node->children[i]->count)
+            index -= node->children[i++]->count;
+
+        node = node->children[i].get();
+    }
+
+    return node;
+}
+
+template <typename Node, typename Visitor>
+void forEachLeaf (const Node& node, Visitor&& visitor)
+{
+    if (node.isLeaf)
+    {
+        visitor (node);
+        return;
+    }
+
+    for (const auto& child : node.children)
+        forEachLeaf (*child, visitor);
+}
+
+template <typename NodePtr>
+TaskStats getStatsOf (const NodePtr& root, const TaskArchive::Ptr& archive) noexcept
+{
+    TaskStats stats;
+
+    if (root != nullptr)
+    {
+        stats.total = root->count;
+        stats.done = root->doneCount;
+        stats.active = root->count - root->doneCount;
+        stats.textBytes = root->textBytes;
+        stats.oldestOpenTask = root->oldestOpen;
+    }
+
+    stats.archived = archive != nullptr ? archive->size() : 0;
+    return stats;
+}
+
+template <typename NodePtr>
+int linearIndexOf (const NodePtr& root, TaskId id)
+{
+    if (root == nullptr)
+        return -1;
+
+    int position = 0;
+    int found = -1;
+
+    forEachLeaf (*root, [&] (const auto& leaf)
+    {
+        for (size_t i = 0; i < leaf.tasks.size(); ++i)
+        {
+            if (found < 0 && leaf.tasks.getId (i) == id)
+                found = position;
+
+            ++position;
+        }
+    });
+
+    return found;
+}
+} // namespace
+
+//==============================================================================
+bool TaskChangeSet::isEmpty() const noexcept
+{
+    return changes.isEmpty() && ! listReplaced && ! collapsedChanged;
+}
+
+bool TaskChangeSet::changesSize() const noexcept
+{
+    if (listReplaced)
+        return true;
+
+    for (const auto& change : changes)
+        if (change.type == TaskChange::Type::inserted || change.type == TaskChange::Type::removed)
+            return true;
+
+    return false;
+}
+
+void TaskChangeSet::add (TaskChange change)
+{
+    if (listReplaced)
+        return;
+
+    if (! changes.isEmpty())
+    {
+        auto& last = changes.getReference (changes.size() - 1);
+
+        if (last.type == change.type)
+        {
+            const auto length = change.range.getLength();
+
+            switch (change.type)
+            {
+                case TaskChange::Type::inserted:
+                    if (last.range.getStart() <= change.range.getStart() && change.range.getStart() <= last.range.getEnd())
+                    {
+                        last.range.setEnd (last.range.getEnd() + length);
+                        return;
+                    }
+                    break;
+
+                case TaskChange::Type::removed:
+                    if (change.range.getStart() == last.range.getStart())
+                    {
+                        last.range.setEnd (last.range.getEnd() + length);
+                        return;
+                    }
+                    if (change.range.getEnd() == last.range.getStart())
+                    {
+                        last.range.setStart (change.range.getStart());
+                        return;
+                    }
+                    break;
+
+                case TaskChange::Type::updated:
+                    if (last.range.getStart() <= change.range.getEnd() && change.range.getStart() <= last.range.getEnd())
+                    {
+                        last.range = last.range.getUnionWith (change.range);
+                        return;
+                    }
+                    break;
+
+                case TaskChange::Type::moved:
+                    break;
+            }
+        }
+    }
+
+    if (changes.size() >= kMaxTrackedChanges)
+    {
+        listReplaced = true;
+        changes.clear();
+        return;
+    }
+
+    changes.add (change);
+}
+
+void TaskChangeSet::append (const TaskChangeSet& later)
+{
+    version = later.version;
+    collapsedChanged = collapsedChanged || later.collapsedChanged;
+
+    if (later.listReplaced)
+    {
+        listReplaced = true;
+        changes.clear();
+        return;
+    }
+
+    for (const auto& change : later.changes)
+        add (change);
+}
+
+/*  Leaves hold the tasks; internal nodes hold children and every node summarises the
+    tasks beneath it, so the root's summary answers getStats() directly. Each leaf also has
+    an order label that increases from left to right, and a node's label is that of its
+    first leaf, which lets TaskIdIndex find a leaf's position by descending the tree.
+*/
+struct TaskSnapshot::Node
+{
+    bool isLeaf = true;
+    int count = 0;
+    int doneCount = 0;
+    juce::int64 textBytes = 0;
+    TaskId oldestOpen = TaskId::invalid;
+    juce::uint64 label = 0;
+    juce::uint64 owner = 0;
+    juce::uint64 key = 0;
+    LeafTaskStore tasks;
+    std::vector<std::shared_ptr<const Node>> children;
+};
+
+struct TaskSnapshot::State
+{
+    juce::uint64 version = 0;
+    juce::uint64 nextTaskId = 1;
+    juce::uint64 nextLeafKey = 1;
+    bool collapsed = false;
+    std::shared_ptr<const Node> root;
+    TaskArchive::Ptr archive;
+};
+
+//==============================================================================
+TaskSnapshot::TaskSnapshot()
+{
+    static const auto emptyState = std::make_shared<const State>();
+    state = emptyState;
+}
+
+TaskSnapshot::TaskSnapshot (std::shared_ptr<const State> stateToUse)
+    : state (std::move (stateToUse))
+{
+}
+
+juce::uint64 TaskSnapshot::getVersion() const noexcept
+{
+    return state->version;
+}
+
+int TaskSnapshot::size() const noexcept
+{
+    return state->root == nullptr ? 0 : state->root->count;
+}
+
+bool TaskSnapshot::isEmpty() const noexcept
+{
+    return size() == 0;
+}
+
+bool TaskSnapshot::getCollapsed() const noexcept
+{
+    return state->collapsed;
+}
+
+TaskStats TaskSnapshot::getStats() const noexcept
+{
+    return getStatsOf (state->root, state->archive);
+}
+
+TaskArchive::Ptr TaskSnapshot::getArchive() const noexcept
+{
+    static const auto emptyArchive = std::make_shared<const TaskArchive>();
+    return state->archive != nullptr ? state->archive : emptyArchive;
+}
+
+std::optional<TaskRef> TaskSnapshot::getTask (int index) const noexcept
+{
+    if (! juce::isPositiveAndBelow (index, size()))
+        return {};
+
+    const auto* leaf = findLeaf (state->root.get(), index);
+    return leaf->tasks.get ((size_t) index);
+}
+
+int TaskSnapshot::getTaskRun (int index, int end, TaskRef* run) const noexcept
+{
+    if (! juce::isPositiveAndBelow (index, size()))
+        return 0;
+
+    auto first = index;
+    const auto* leaf = findLeaf (state->root.get(), first);
+    const auto runLength = juce::jmin (end - index, (int) leaf->tasks.size() - first, maxRunLength);
+
+    for (int i = 0; i < runLength; ++i)
+        run[i] = leaf->tasks.get ((size_t) (first + i));
+
+    return runLength;
+}
+
+//==============================================================================
+int TaskIdIndex::indexOf (const TaskSnapshot& snapshot, TaskId id) const
+{
+    const auto& state = *snapshot.state;
+
+    if (valid && version == state.version)
+        return find (state.root, id);
+
+    return linearIndexOf (state.root, id);
+}
+
+void TaskIdIndex::rebuild (const NodePtr& root)
+{
+    leafOfTask.clear();
+    leafLabels.clear();
+
+    if (root == nullptr)
+        return;
+
+    forEachLeaf (*root, [this] (const TaskSnapshot::Node& leaf)
+    {
+        leafLabels[leaf.key] = leaf.label;
+
+        for (size_t i = 0; i < leaf.tasks.size(); ++i)
+            leafOfTask[leaf.tasks.getId (i)] = leaf.key;
+    });
+}
+
+int TaskIdIndex::find (const NodePtr& root, TaskId id) const
+{
+    const auto leafKey = leafOfTask.find (id);
+    if (leafKey == leafOfTask.end())
+        return -1;
+
+    const auto label = leafLabels.at (leafKey->second);
+    const auto* node = root.get();
+    int position = 0;
+
+    while (! node->isLeaf)
+    {
+        auto i = node->children.size() - 1;
+        while (i > 0 && node->children[i]->label > label)
+            --i;
+
+        for (size_t j = 0; j < i; ++j)
+            position += node->children[j]->count;
+
+        node = node->children[i].get();
+    }
+
+    jassert (node->key == leafKey->second);
+
+    for (size_t i = 0; i < node->tasks.size(); ++i)
+        if (node->tasks.getId (i) == id)
+            return position + (int) i;
+
+    jassertfalse;
+    return -1;
+}
+
+//==============================================================================
+TaskSnapshotBuilder::TaskSnapshotBuilder (const TaskSnapshot& base, TaskIdIndex* idIndexToUpdate, TaskTextIndex* textIndexToUpdate)
+    : baseVersion (base.state->version),
+      nextTaskId (base.state->nextTaskId),
+      nextLeafKey (base.state->nextLeafKey),
+      collapsed (base.state->collapsed),
+      root (base.state->root),
+      archive (base.state->archive),
+      editToken (createEditToken()),
+      idIndex (idIndexToUpdate),
+      textIndex (textIndexToUpdate)
+{
+    if (idIndex != nullptr && (! idIndex->valid || idIndex->version != baseVersion))
+    {
+        idIndex->rebuild (root);
+        idIndex->version = baseVersion;
+        idIndex->valid = true;
+    }
+
+    if (textIndex != nullptr && (! textIndex->valid || textIndex->version != baseVersion))
+        textIndex->rebuild (base);
+}
+
+int TaskSnapshotBuilder::size() const noexcept
+{
+    return root == nullptr ? 0 : root->count;
+}
+
+std::optional<TaskRef> TaskSnapshotBuilder::getTask (int index) const noexcept
+{
+    if (! juce::isPositiveAndBelow (index, size()))
+        return {};
+
+    const auto* leaf = findLeaf (root.get(), index);
+    return leaf->tasks.get ((size_t) index);
+}
+
+int TaskSnapshotBuilder::indexOf (TaskId id) const
+{
+    if (idIndex != nullptr)
+        return idIndex->find (root, id);
+
+    return linearIndexOf (root, id);
+}
+
+// Until build() is called, the index describes this builder rather than any snapshot.
+TaskIdIndex* TaskSnapshotBuilder::getIndexForEdit() noexcept
+{
+    if (idIndex != nullptr)
+        idIndex->valid = false;
+
+    return idIndex;
+}
+
+TaskTextIndex* TaskSnapshotBuilder::getTextIndexForEdit() noexcept
+{
+    if (textIndex != nullptr)
+        textIndex->valid = false;
+
+    return textIndex;
+}
+
+std::shared_ptr<TaskSnapshot::Node> TaskSnapshotBuilder::createNode (bool isLeaf)
+{
+    auto node = std::make_shared<TaskSnapshot::Node>();
+    node->isLeaf = isLeaf;
+    node->owner = editToken;
+
+    if (isLeaf)
+        node->key = nextLeafKey++;
+
+    return node;
+}
+
+TaskSnapshot::Node& TaskSnapshotBuilder::makeWritable (NodePtr& node)
+{
+    if (node->owner != editToken)
+    {
+        auto copy = std::make_shared<TaskSnapshot::Node> (*node);
+        copy->owner = editToken;
+        node = std::move (copy);
+    }
+
+    // Nodes carrying this builder's token were created by it and haven't been published yet.
+    return const_cast<TaskSnapshot::Node&> (*node);
+}
+
+TaskId TaskSnapshotBuilder::insert (int index, TodoTask task)
+{
+    index = juce::jlimit (0, size(), index);
+    const auto id = insertTask (index, refTo (task));
+
+    if (auto* textIndexToUpdate = getTextIndexForEdit())
+        textIndexToUpdate->add (id, task.text.toUTF8());
+
+    changes.add ({ TaskChange::Type::inserted, { index, index + 1 } });
+    return id;
+}
+
+void TaskSnapshotBuilder::remove (int index)
+{
+    if (! juce::isPositiveAndBelow (index, size()))
+        return;
+
+    if (auto* textIndexToUpdate = getTextIndexForEdit())
+        textIndexToUpdate->remove (getTask (index)->text);
+
+    removeTask (index);
+    changes.add ({ TaskChange::Type::removed, { index, index + 1 } });
+}
+
+TaskId TaskSnapshotBuilder::insertTask (int index, TaskRef task)
+{
+    if (task.id == TaskId::invalid)
+        task.id = TaskId (nextTaskId++);
+    else
+        nextTaskId = juce::jmax (nextTaskId, (juce::uint64) task.id + 1);
+
+    const auto id = task.id;
+
+    if (root == nullptr)
+    {
+        auto leaf = createNode (true);
+        leaf->label = kLabelSpacing;
+
+        if (auto* idIndexToUpdate = getIndexForEdit())
+            idIndexToUpdate->leafLabels[leaf->key] = leaf->label;
+
+        root = std::move (leaf);
+    }
+
+    if (auto sibling = insertInto (root, index, task, std::numeric_limits<juce::uint64>::max()))
+    {
+        auto newRoot = createNode (false);
+        newRoot->label = root->label;
+        newRoot->children = { root, std::move (sibling) };
+        summarise (*newRoot);
+        root = std::move (newRoot);
+    }
+
+    if (needsRelabel)
+        relabel();
+
+    return id;
+}
+
+TaskSnapshotBuilder::NodePtr TaskSnapshotBuilder::insertInto (NodePtr& nodeRef, int index, const TaskRef& task, juce::uint64 nextLabel)
+{
+    auto& node = makeWritable (nodeRef);
+
+    if (node.isLeaf)
+    {
+        // A full leaf splits before taking the task, so its done flags always fit one mask.
+        if (node.tasks.size() < kMaxLeafSize)
+        {
+            insertIntoLeaf (node, index, task);
+            return nullptr;
+        }
+
+        auto sibling = splitNode (node, nextLabel);
+        const auto numKept = (int) node.tasks.size();
+
+        if (index <= numKept)
+            insertIntoLeaf (node, index, task);
+        else
+            insertIntoLeaf (makeWritable (sibling), index - numKept, task);
+
+        return sibling;
+    }
+
+    size_t i = 0;
+    while (i + 1 < node.children.size() && index > node.children[i]->count)
+        index -= node.children[i++]->count;
+
+    const auto childNextLabel = i + 1 < node.children.size() ? node.children[i + 1]->label : nextLabel;
+
+    if (auto sibling = insertInto (node.children[i], index, task, childNextLabel))
+        node.children.insert (node.children.begin() + (std::ptrdiff_t) i + 1, std::move (sibling));
+
+    summarise (node);
+    return node.children.size() > kMaxChildren ? splitNode (node, nextLabel) : nullptr;
+}
+
+void TaskSnapshotBuilder::insertIntoLeaf (TaskSnapshot::Node& leaf, int index, const TaskRef& task)
+{
+    if (auto* idIndexToUpdate = getIndexForEdit())
+        idIndexToUpdate->leafOfTask[task.id] = leaf.key;
+
+    addToLeafSummary (leaf, task);
+    leaf.tasks.insert ((size_t) index, task);
+}
+
+TaskSnapshotBuilder::NodePtr TaskSnapshotBuilder::splitNode (TaskSnapshot::Node& node, juce::uint64 nextLabel)
+{
+    auto sibling = createNode (node.isLeaf);
+
+    if (node.isLeaf)
+    {
+        node.tasks.moveTailTo (sibling->tasks, node.tasks.size() / 2);
+
+        // Labels are spread out when the gap runs out; until then this leaf shares its label.
+        const auto gap = nextLabel - node.label;
+        if (gap < 2)
+            needsRelabel = true;
+
+        sibling->label = gap < 2 ? node.label : node.label + juce::jmin (gap / 2, kLabelSpacing);
+
+        if (auto* idIndexToUpdate = getIndexForEdit())
+        {
+            idIndexToUpdate->leafLabels[sibling->key] = sibling->label;
+
+            for (size_t i = 0; i < sibling->tasks.size(); ++i)
+                idIndexToUpdate->leafOfTask[sibling->tasks.getId (i)] = sibling->key;
+        }
+    }
+    else
+    {
+        const auto half = (std::ptrdiff_t) (node.children.size() / 2);
+        sibling->children.assign (node.children.begin() + half, node.children.end());
+        node.children.erase (node.children.begin() + half, node.children.end());
+        sibling->label = sibling->children.front()->label;
+    }
+
+    summarise (node);
+    summarise (*sibling);
+    return sibling;
+}
+
+void TaskSnapshotBuilder::relabel()
+{
+    needsRelabel = false;
+    auto nextLabel = kLabelSpacing;
+    relabelFrom (root, nextLabel);
+}
+
+void TaskSnapshotBuilder::relabelFrom (NodePtr& nodeRef, juce::uint64& nextLabel)
+{
+    auto& node = makeWritable (nodeRef);
+
+    if (node.isLeaf)
+    {
+        node.label = nextLabel;
+        nextLabel += kLabelSpacing;
+
+        if (auto* idIndexToUpdate = getIndexForEdit())
+            idIndexToUpdate->leafLabels[node.key] = node.label;
+
+        return;
+    }
+
+    for (auto& child : node.children)
+        relabelFrom (child, nextLabel);
+
+    node.label = node.children.front()->label;
+}
+
+void TaskSnapshotBuilder::removeTask (int index)
+{
+    removeFrom (root, index);
+    collapseRoot();
+}
+
+void TaskSnapshotBuilder::removeFrom (NodePtr& nodeRef, int index)
+{
+    auto& node = makeWritable (nodeRef);
+
+    if (node.isLeaf)
+    {
+        const auto task = node.tasks.get ((size_t) index);
+
+        if (auto* idIndexToUpdate = getIndexForEdit())
+            idIndexToUpdate->leafOfTask.erase (task.id);
+
+        const auto wasOldestOpen = task.id == node.oldestOpen;
+        --node.count;
+        node.textBytes -= task.numBytes;
+        node.doneCount -= task.done ? 1 : 0;
+        node.tasks.erase ((size_t) index);
+
+        if (wasOldestOpen)
+            refreshOldestOpen (node);
+
+        return;
+    }
+
+    size_t i = 0;
+    while (index >= node.children[i]->count)
+        index -= node.children[i++]->count;
+
+    removeFrom (node.children[i], index);
+    fixUnderfullChild (node, i);
+    summarise (node);
+}
+
+void TaskSnapshotBuilder::fixUnderfullChild (TaskSnapshot::Node& parent, size_t childIndex)
+{
+    const auto& child = *parent.children[childIndex];
+    const auto fill = getFill (child);
+
+    if (fill == 0)
+    {
+        if (child.isLeaf)
+            if (auto* idIndexToUpdate = getIndexForEdit())
+                idIndexToUpdate->leafLabels.erase (child.key);
+
+        parent.children.erase (parent.children.begin() + (std::ptrdiff_t) childIndex);
+    }
+    else if (fill < (child.isLeaf ? kMergeLeafSize : kMergeChildren))
+    {
+        const auto maxFill = child.isLeaf ? kMaxLeafSize : kMaxChildren;
+
+        if (childIndex + 1 < parent.children.size() && fill + getFill (*parent.children[childIndex + 1]) <= maxFill)
+            mergeChildren (parent, childIndex);
+        else if (childIndex > 0 && getFill (*parent.children[childIndex - 1]) + fill <= maxFill)
+            mergeChildren (parent, childIndex - 1);
+    }
+
+    if (! parent.children.empty())
+        parent.label = parent.children.front()->label;
+}
+
+void TaskSnapshotBuilder::mergeChildren (TaskSnapshot::Node& parent, size_t leftIndex)
+{
+    auto& target = makeWritable (parent.children[leftIndex]);
+    const auto& source = *parent.children[leftIndex + 1];
+
+    if (target.isLeaf)
+    {
+        if (auto* idIndexToUpdate = getIndexForEdit())
+        {
+            for (size_t i = 0; i < source.tasks.size(); ++i)
+                idIndexToUpdate->leafOfTask[source.tasks.getId (i)] = target.key;
+
+            idIndexToUpdate->leafLabels.erase (source.key);
+        }
+
+        target.tasks.reserve (target.tasks.size() + source.tasks.size(), (size_t) source.textBytes);
+
+        for (size_t i = 0; i < source.tasks.size(); ++i)
+            target.tasks.add (source.tasks.get (i));
+
+        target.count += source.count;
+        target.doneCount += source.doneCount;
+        target.textBytes += source.textBytes;
+        target.oldestOpen = getOlderTask (target.oldestOpen, source.oldestOpen);
+    }
+    else
+    {
+        target.children.insert (target.children.end(), source.children.begin(), source.children.end());
+        summarise (target);
+    }
+
+    parent.children.erase (parent.children.begin() + (std::ptrdiff_t) leftIndex + 1);
+}
+
+void TaskSnapshotBuilder::collapseRoot()
+{
+    while (root != nullptr)
+    {
+        if (root->isLeaf)
+        {
+            if (root->tasks.empty())
+            {
+                if (auto* idIndexToUpdate = getIndexForEdit())
+                    idIndexToUpdate->leafLabels.erase (root->key);
+
+                root = nullptr;
+            }
+
+            return;
+        }
+
+        if (root->children.size() > 1)
+            return;
+
+        auto onlyChild = root->children.empty() ? nullptr : root->children.front();
+        root = std::move (onlyChild);
+    }
+}
+
+void TaskSnapshotBuilder::move (int from, int to)
+{
+    if (! juce::isPositiveAndBelow (from, size()) || ! juce::isPositiveAndBelow (to, size()) || from == to)
+        return;
+
+    // The text and position have to outlive the removal, which may compact the arena the
+    // text lives in and drops the position from its leaf.
+    auto task = *getTask (from);
+    const std::string text (task.text.getAddress(), (size_t) task.numBytes);
+    task.text = juce::CharPointer_UTF8 (text.c_str());
+
+    const auto position = task.position != nullptr ? std::optional<TaskPosition> (*task.position) : std::nullopt;
+    task.position = position.has_value() ? &*position : nullptr;
+
+    removeTask (from);
+    insertTask (to, task);
+    changes.add ({ TaskChange::Type::moved, { from, from + 1 }, to });
+}
+
+int TaskSnapshotBuilder::removeIf (const std::function<bool (const TaskRef&)>& shouldRemove)
+{
+    if (root == nullptr)
+        return 0;
+
+    int position = 0;
+    const auto numRemoved = removeMatching (root, shouldRemove, position);
+
+    if (numRemoved > 0)
+        collapseRoot();
+
+    return numRemoved;
+}
+
+int TaskSnapshotBuilder::removeMatching (NodePtr& nodeRef, const std::function<bool (const TaskRef&)>& shouldRemove, int& position)
+{
+    if (nodeRef->isLeaf)
+    {
+        const auto& source = nodeRef->tasks;
+        auto firstMatch = (size_t) 0;
+
+        while (firstMatch < source.size() && ! shouldRemove (source.get (firstMatch)))
+            ++firstMatch;
+
+        if (firstMatch == source.size())
+        {
+            position += (int) source.size();
+            return 0;
+        }
+
+        auto& leaf = makeWritable (nodeRef);
+        auto* idIndexToUpdate = getIndexForEdit();
+        auto* textIndexToUpdate = getTextIndexForEdit();
+        LeafTaskStore kept;
+
+        for (size_t i = 0; i < leaf.tasks.size(); ++i)
+        {
+            const auto task = leaf.tasks.get (i);
+
+            if (i == firstMatch || (i > firstMatch && shouldRemove (task)))
+            {
+                if (idIndexToUpdate != nullptr)
+                    idIndexToUpdate->leafOfTask.erase (task.id);
+
+                if (textIndexToUpdate != nullptr)
+                    textIndexToUpdate->remove (task.text);
+
+                changes.add ({ TaskChange::Type::removed, { position, position + 1 } });
+                continue;
+            }
+
+            kept.add (task);
+            ++position;
+        }
+
+        leaf.tasks = std::move (kept);
+
+        const auto numRemoved = leaf.count - (int) leaf.tasks.size();
+        summarise (leaf);
+        return numRemoved;
+    }
+
+    int numRemoved = 0;
+
+    for (size_t i = 0; i < nodeRef->children.size(); ++i)
+    {
+        auto child = nodeRef->children[i];
+        const auto removedHere = removeMatching (child, shouldRemove, position);
+
+        if (removedHere > 0)
+        {
+            makeWritable (nodeRef).children[i] = std::move (child);
+            numRemoved += removedHere;
+        }
+    }
+
+    if (numRemoved == 0)
+        return 0;
+
+    auto& node = makeWritable (nodeRef);
+
+    for (size_t i = 0; i < node.children.size();)
+    {
+        const auto numChildren = node.children.size();
+        fixUnderfullChild (node, i);
+
+        if (node.children.size() == numChildren)
+            ++i;
+    }
+
+    summarise (node);
+    return numRemoved;
+}
+
+void TaskSnapshotBuilder::setDone (int index, bool done)
+{
+    if (! juce::isPositiveAndBelow (index, size()))
+        return;
+
+    setDoneIn (root, index, done);
+    changes.add ({ TaskChange::Type::updated, { index, index + 1 } });
+}
+
+void TaskSnapshotBuilder::setDoneIn (NodePtr& nodeRef, int index, bool done)
+{
+    auto& node = makeWritable (nodeRef);
+
+    if (node.isLeaf)
+    {
+        if (node.tasks.isDone ((size_t) index) != done)
+        {
+            node.tasks.setDone ((size_t) index, done);
+            node.doneCount += done ? 1 : -1;
+            refreshOldestOpen (node);
+        }
+
+        return;
+    }
+
+    size_t i = 0;
+    while (index >= node.children[i]->count)
+        index -= node.children[i++]->count;
+
+    setDoneIn (node.children[i], index, done);
+    summarise (node);
+}
+
+bool TaskSnapshotBuilder::getCollapsed() const noexcept
+{
+    return collapsed;
+}
+
+void TaskSnapshotBuilder::setCollapsed (bool shouldCollapse)
+{
+    if (collapsed == shouldCollapse)
+        return;
+
+    collapsed = shouldCollapse;
+    changes.collapsedChanged = true;
+}
+
+void TaskSnapshotBuilder::setTasks (const juce::Array<TodoTask>& newTasks)
+{
+    changes.listReplaced = true;
+    changes.changes.clear();
+
+    auto* textIndexToUpdate = getTextIndexForEdit();
+    if (textIndexToUpdate != nullptr)
+        textIndexToUpdate->clear();
+
+    std::vector<NodePtr> level;
+
+    for (int start = 0; start < newTasks.size(); start += (int) kFillLeafSize)
+    {
+        const auto end = juce::jmin (newTasks.size(), start + (int) kFillLeafSize);
+        auto leaf = createNode (true);
+        leaf->label = (juce::uint64) (level.size() + 1) * kLabelSpacing;
+
+        size_t numTextBytes = 0;
+        for (auto i = start; i < end; ++i)
+            numTextBytes += newTasks.getReference (i).text.getNumBytesAsUTF8();
+
+        leaf->tasks.reserve ((size_t) (end - start), numTextBytes);
+
+        for (auto i = start; i < end; ++i)
+        {
+            auto task = refTo (newTasks.getReference (i));
+
+            if (task.id == TaskId::invalid)
+                task.id = TaskId (nextTaskId++);
+            else
+                nextTaskId = juce::jmax (nextTaskId, (juce::uint64) task.id + 1);
+
+            leaf->tasks.add (task);
+
+            if (textIndexToUpdate != nullptr)
+                textIndexToUpdate->add (task.id, task.text);
+        }
+
+        summarise (*leaf);
+        level.push_back (std::move (leaf));
+    }
+
+    while (level.size() > 1)
+    {
+        std::vector<NodePtr> parents;
+
+        for (size_t start = 0; start < level.size(); start += kFillChildren)
+        {
+            auto parent = createNode (false);
+            parent->children.assign (level.begin() + (std::ptrdiff_t) start,
+                                     level.begin() + (std::ptrdiff_t) juce::jmin (level.size(), start + kFillChildren));
+
+            summarise (*parent);
+            parent->label = parent->children.front()->label;
+            parents.push_back (std::move (parent));
+        }
+
+        level = std::move (parents);
+    }
+
+    root = level.empty() ? nullptr : level.front();
+    needsRelabel = false;
+
+    if (auto* index = getIndexForEdit())
+        index->rebuild (root);
+}
+
+int TaskSnapshotBuilder::archiveIf (const std::function<bool (const TaskRef&)>& shouldArchive)
+{
+    juce::StringArray archived;
+
+    const auto numArchived = removeIf ([&] (const TaskRef& task)
+    {
+        if (! shouldArchive (task))
+            return false;
+
+        archived.add (task.getText());
+        return true;
+    });
+
+    if (numArchived > 0)
+        archive = (archive != nullptr ? *archive : TaskArchive()).withTasks (archived);
+
+    return numArchived;
+}
+
+TaskArchive::Ptr TaskSnapshotBuilder::getArchive() const noexcept
+{
+    return archive;
+}
+
+void TaskSnapshotBuilder::setArchive (TaskArchive::Ptr newArchive)
+{
+    archive = std::move (newArchive);
+}
+
+TaskStats TaskSnapshotBuilder::getStats() const noexcept
+{
+    return getStatsOf (root, archive);
+}
+
+TaskSnapshot TaskSnapshotBuilder::build()
+{
+    auto state = std::make_shared<TaskSnapshot::State>();
+    state->version = baseVersion + 1;
+    state->nextTaskId = nextTaskId;
+    state->nextLeafKey = nextLeafKey;
+    state->collapsed = collapsed;
+    state->root = root;
+    state->archive = archive;
+
+    editToken = createEditToken();
+    baseVersion = state->version;
+    changes.version = state->version;
+
+    if (idIndex != nullptr)
+    {
+        idIndex->version = state->version;
+        idIndex->valid = true;
+    }
+
+    TaskSnapshot snapshot (std::move (state));
+
+    if (textIndex != nullptr)
+    {
+        if (textIndex->isMostlyStale())
+            textIndex->rebuild (snapshot);
+
+        textIndex->version = snapshot.getVersion();
+        textIndex->valid = true;
+    }
+
+    return snapshot;
+}
+
+//==============================================================================
+AtomicTaskSnapshot::AtomicTaskSnapshot()
+    : current (TaskSnapshot().state)
+{
+}
+
+TaskSnapshot AtomicTaskSnapshot::load() const noexcept
+{
+    return TaskSnapshot (current.load());
+}
+
+void AtomicTaskSnapshot::store (const TaskSnapshot& newSnapshot) noexcept
+{
+    current.store (newSnapshot.state);
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "TaskArchive.h"
+#include "LockFreeSharedPtr.h"
+#include "TaskTextIndex.h"
+
+enum class TaskId : juce::uint64
+{
+    invalid = 0
+};
+
+struct TaskPosition
+{
+    std::optional<double> timeInSeconds;
+    std::optional<double> ppq;
+    std::optional<juce::int64> bar;
+
+    bool isEmpty() const noexcept   { return ! timeInSeconds && ! ppq && ! bar; }
+};
+
+struct TodoTask
+{
+    juce::String text;
+    bool done = false;
+    TaskId id = TaskId::invalid;
+    std::optional<TaskPosition> position;
+};
+
+// Points into its snapshot's storage, so it's only valid while that snapshot is.
+struct TaskRef
+{
+    juce::CharPointer_UTF8 text { "" };
+    int numBytes = 0;
+    bool done = false;
+    TaskId id = TaskId::invalid;
+    const TaskPosition* position = nullptr;
+
+    juce::String getText() const    { return { text, juce::CharPointer_UTF8 (text.getAddress() + numBytes) }; }
+
+    TodoTask toTask() const
+    {
+        return { getText(), done, id, position != nullptr ? std::optional<TaskPosition> (*position) : std::nullopt };
+    }
+};
+
+struct TaskStats
+{
+    int total = 0;
+    int done = 0;
+    int active = 0;
+    juce::int64 textBytes = 0;
+    TaskId oldestOpenTask = TaskId::invalid;
+    int archived = 0;
+};
+
+// The range indexes the list as it was just before this change.
+struct TaskChange
+{
+    enum class Type
+    {
+        inserted,
+        removed,
+        moved,
+        updated
+    };
+
+    Type type = Type::updated;
+    juce::Range<int> range;
+    int destination = -1;
+};
+
+struct TaskChangeSet
+{
+    juce::uint64 version = 0;
+    juce::Array<TaskChange> changes;
+    bool listReplaced = false;
+    bool collapsedChanged = false;
+
+    bool isEmpty() const noexcept;
+    bool changesSize() const noexcept;
+    void add (TaskChange change);
+    void append (const TaskChangeSet& later);
+};
+
+// Immutable once published, so any thread may read it without locking. Tasks live in
+// the leaves of a counted B+tree; each leaf packs its text into one arena.
+class TaskSnapshot
+{
+public:
+    TaskSnapshot();
+
+    juce::uint64 getVersion() const noexcept;
+    int size() const noexcept;
+    bool isEmpty() const noexcept;
+    bool getCollapsed() const noexcept;
+    TaskStats getStats() const noexcept;
+    TaskArchive::Ptr getArchive() const noexcept;
+    std::optional<TaskRef> getTask (int index) const noexcept;
+
+    template <typename Visitor>
+    void visitTasks (int startIndex, int endIndex, Visitor&& visitor) const
+    {
+        auto index = juce::jmax (0, startIndex);
+        const auto end = juce::jmin (endIndex, size());
+        TaskRef run[maxRunLength];
+
+        while (index < end)
+        {
+            const auto runLength = getTaskRun (index, end, run);
+
+            for (int i = 0; i < runLength; ++i)
+                visitor (index + i, run[i]);
+
+            index += runLength;
+        }
+    }
+
+private:
+    struct Node;
+    struct State;
+
+    static constexpr int maxRunLength = 64;
+
+    explicit TaskSnapshot (std::shared_ptr<const State> stateToUse);
+
+    int getTaskRun (int index, int end, TaskRef* run) const noexcept;
+
+    std::shared_ptr<const State> state;
+
+    friend class TaskSnapshotBuilder;
+    friend class TaskIdIndex;
+    friend class AtomicTaskSnapshot;
+};
+
+// Only valid for the snapshot it was last brought up to date with; pass it to each
+// builder that derives the next version.
+class TaskIdIndex
+{
+public:
+    TaskIdIndex() = default;
+
+    int indexOf (const TaskSnapshot& snapshot, TaskId id) const;
+
+private:
+    using NodePtr = std::shared_ptr<const TaskSnapshot::Node>;
+
+    std::unordered_map<TaskId, juce::uint64> leafOfTask;
+    std::unordered_map<juce::uint64, juce::uint64> leafLabels;
+    juce::uint64 version = 0;
+    bool valid = true;
+
+    void rebuild (const NodePtr& root);
+    int find (const NodePtr& root, TaskId id) const;
+
+    friend class TaskSnapshotBuilder;
+    JUCE_DECLARE_NON_COPYABLE (TaskIdIndex)
+};
+
+class TaskSnapshotBuilder
+{
+public:
+    explicit TaskSnapshotBuilder (const TaskSnapshot& base,
+                                  TaskIdIndex* idIndexToUpdate = nullptr,
+                                  TaskTextIndex* textIndexToUpdate = nullptr);
+
+    int size() const noexcept;
+
+    // The TaskRef is only valid until the next edit made through this builder.
+    std::optional<TaskRef> getTask (int index) const noexcept;
+    int indexOf (TaskId id) const;
+
+    TaskId insert (int index, TodoTask task);
+    void remove (int index);
+    void move (int from, int to);
+    int removeIf (const std::function<bool (const TaskRef&)>& shouldRemove);
+
+    void setDone (int index, bool done);
+    bool getCollapsed() const noexcept;
+    void setCollapsed (bool shouldCollapse);
+    void setTasks (const juce::Array<TodoTask>& newTasks);
+
+    int archiveIf (const std::function<bool (const TaskRef&)>& shouldArchive);
+    TaskArchive::Ptr getArchive() const noexcept;
+    void setArchive (TaskArchive::Ptr newArchive);
+    TaskStats getStats() const noexcept;
+
+    TaskSnapshot build();
+    const TaskChangeSet& getChanges() const noexcept { return changes; }
+
+private:
+    using NodePtr = std::shared_ptr<const TaskSnapshot::Node>;
+
+    juce::uint64 baseVersion = 0;
+    juce::uint64 nextTaskId = 1;
+    juce::uint64 nextLeafKey = 1;
+    bool collapsed = false;
+    NodePtr root;
+    TaskArchive::Ptr archive;
+    juce::uint64 editToken = 0;
+    bool needsRelabel = false;
+    TaskChangeSet changes;
+    TaskIdIndex* idIndex = nullptr;
+    TaskTextIndex* textIndex = nullptr;
+
+    TaskIdIndex* getIndexForEdit() noexcept;
+    TaskTextIndex* getTextIndexForEdit() noexcept;
+    std::shared_ptr<TaskSnapshot::Node> createNode (bool isLeaf);
+    TaskSnapshot::Node& makeWritable (NodePtr& node);
+
+    TaskId insertTask (int index, TaskRef task);
+    NodePtr insertInto (NodePtr& node, int index, const TaskRef& task, juce::uint64 nextLabel);
+    void insertIntoLeaf (TaskSnapshot::Node& leaf, int index, const TaskRef& task);
+    NodePtr splitNode (TaskSnapshot::Node& node, juce::uint64 nextLabel);
+    void relabel();
+    void relabelFrom (NodePtr& node, juce::uint64& nextLabel);
+
+    void removeTask (int index);
+    void removeFrom (NodePtr& node, int index);
+    int removeMatching (NodePtr& node, const std::function<bool (const TaskRef&)>& shouldRemove, int& position);
+    void fixUnderfullChild (TaskSnapshot::Node& parent, size_t childIndex);
+    void mergeChildren (TaskSnapshot::Node& parent, size_t leftIndex);
+    void collapseRoot();
+    void setDoneIn (NodePtr& node, int index, bool done);
+
+    JUCE_DECLARE_NON_COPYABLE (TaskSnapshotBuilder)
+};
+
+// load() may be called from any thread and never locks; store() by one thread at a time.
+class AtomicTaskSnapshot
+{
+public:
+    AtomicTaskSnapshot();
+
+    TaskSnapshot load() const noexcept;
+    void store (const TaskSnapshot& newSnapshot) noexcept;
+
+private:
+    LockFreeSharedPtr<const TaskSnapshot::State> current;
+
+    JUCE_DECLARE_NON_COPYABLE (AtomicTaskSnapshot)
+};
@@ -0,0 +1,133 @@
+#include "TaskTextIndex.h"
+#include "TaskSnapshot.h"
+
+TaskTextIndex::Query::Query (const juce::String& textToFind)
+    : text (textToFind),
+      ngrams (getNgrams (textToFind.toUTF8(), textToFind.length() >= 3 ? 3 : 2))
+{
+    for (auto p = text.toUTF8(); ! p.isEmpty();)
+    {
+        const auto c = p.getAndAdvance();
+
+        if (c >= 0x80)
+        {
+            isAscii = false;
+            break;
+        }
+
+        const auto lower = (char) juce::CharacterFunctions::toLowerCase (c);
+        asciiLowerCase += lower;
+        asciiCaseBits += (lower >= 'a' && lower <= 'z') ? (char) 0x20 : (char) 0;
+    }
+}
+
+bool TaskTextIndex::Query::matches (juce::CharPointer_UTF8 taskText, int numBytes) const noexcept
+{
+    if (! isAscii)
+        return juce::CharacterFunctions::indexOfIgnoreCase (taskText, text.toUTF8()) >= 0;
+
+    // Bytes of multi-byte characters are all >= 0x80, so they never match an ASCII byte.
+    // Setting 0x20 lower-cases a letter, and only a letter's two cases end up equal.
+    const auto* bytes = reinterpret_cast<const juce::uint8*> (taskText.getAddress());
+    const auto* needle = reinterpret_cast<const juce::uint8*> (asciiLowerCase.data());
+    const auto* caseBits = reinterpret_cast<const juce::uint8*> (asciiCaseBits.data());
+    const auto length = asciiLowerCase.size();
+
+    for (size_t start = 0; start + length <= (size_t) numBytes; ++start)
+    {
+        if ((bytes[start] | caseBits[0]) != needle[0])
+            continue;
+
+        size_t i = 1;
+
+        while (i < length && (bytes[start + i] | caseBits[i]) == needle[i])
+            ++i;
+
+        if (i == length)
+            return true;
+    }
+
+    return false;
+}
+
+//==============================================================================
+const std::vector<TaskId>* TaskTextIndex::findCandidates (const TaskSnapshot& snapshot, const Query& query) const
+{
+    if (! valid || version != snapshot.getVersion() || query.ngrams.empty())
+        return nullptr;
+
+    static const std::vector<TaskId> none;
+    const std::vector<TaskId>* rarest = nullptr;
+
+    for (const auto ngram : query.ngrams)
+    {
+        const auto tasks = tasksWithNgram.find (ngram);
+        if (tasks == tasksWithNgram.end())
+            return &none;
+
+        if (rarest == nullptr || tasks->second.size() < rarest->size())
+            rarest = &tasks->second;
+    }
+
+    return rarest;
+}
+
+void TaskTextIndex::add (TaskId id, juce::CharPointer_UTF8 text)
+{
+    for (const auto ngram : getNgrams (text, 2))
+    {
+        tasksWithNgram[ngram].push_back (id);
+        ++numEntries;
+    }
+}
+
+void TaskTextIndex::remove (juce::CharPointer_UTF8 text)
+{
+    numStaleEntries += getNgrams (text, 2).size();
+}
+
+void TaskTextIndex::clear()
+{
+    tasksWithNgram.clear();
+    numEntries = 0;
+    numStaleEntries = 0;
+}
+
+void TaskTextIndex::rebuild (const TaskSnapshot& snapshot)
+{
+    clear();
+    snapshot.visitTasks (0, snapshot.size(), [this] (int, const TaskRef& task) { add (task.id, task.text); });
+    version = snapshot.getVersion();
+    valid = true;
+}
+
+bool TaskTextIndex::isMostlyStale() const noexcept
+{
+    return numStaleEntries > numEntries / 2;
+}
+
+// Each n-gram packs its lower-cased code points, 21 bits apiece. No code point is zero, so
+// a bigram never collides with a trigram. Returns the text's trigrams, and its bigrams too
+// if minLength is 2, sorted and without repeats.
+std::vector<juce::uint64> TaskTextIndex::getNgrams (juce::CharPointer_UTF8 text, int minLength)
+{
+    std::vector<juce::uint64> ngrams;
+    juce::uint64 window = 0;
+    int length = 0;
+
+    while (! text.isEmpty())
+    {
+        const auto c = (juce::uint64) juce::CharacterFunctions::toLowerCase (text.getAndAdvance()) & 0x1fffff;
+        window = ((window << 21) | c) & ((juce::uint64 (1) << 63) - 1);
+
+        if (++length >= 3)
+            ngrams.push_back (window);
+
+        if (length >= 2 && minLength <= 2)
+            ngrams.push_back (window & ((juce::uint64 (1) << 42) - 1));
+    }
+
+    std::sort (ngrams.begin(), ngrams.end());
+    ngrams.erase (std::unique (ngrams.begin(), ngrams.end()), ngrams.end());
+    return ngrams;
+}
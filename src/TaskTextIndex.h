@@ -0,0 +1,54 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+class TaskSnapshot;
+enum class TaskId : juce::uint64;
+
+// Indexes every two and three character run, ignoring case. Removed tasks stay in the
+// lists until more than half is stale. Like TaskIdIndex, only valid for the snapshot it
+// was last brought up to date with.
+class TaskTextIndex
+{
+public:
+    TaskTextIndex() = default;
+
+    class Query
+    {
+    public:
+        explicit Query (const juce::String& textToFind);
+
+        bool isEmpty() const noexcept       { return text.isEmpty(); }
+        bool matches (juce::CharPointer_UTF8 taskText, int numBytes) const noexcept;
+
+    private:
+        juce::String text;
+        std::string asciiLowerCase, asciiCaseBits;
+        bool isAscii = true;
+        std::vector<juce::uint64> ngrams;
+
+        friend class TaskTextIndex;
+    };
+
+    // The list belongs to the index and is only valid until it next changes. nullptr means
+    // every task has to be checked.
+    const std::vector<TaskId>* findCandidates (const TaskSnapshot& snapshot, const Query& query) const;
+
+private:
+    std::unordered_map<juce::uint64, std::vector<TaskId>> tasksWithNgram;
+    size_t numEntries = 0;
+    size_t numStaleEntries = 0;
+    juce::uint64 version = 0;
+    bool valid = true;
+
+    void add (TaskId id, juce::CharPointer_UTF8 text);
+    void remove (juce::CharPointer_UTF8 text);
+    void clear();
+    void rebuild (const TaskSnapshot& snapshot);
+    bool isMostlyStale() const noexcept;
+
+    static std::vector<juce::uint64> getNgrams (juce::CharPointer_UTF8 text, int minLength);
+
+    friend class TaskSnapshotBuilder;
+    JUCE_DECLARE_NON_COPYABLE (TaskTextIndex)
+};